@@ -14,6 +14,8 @@
 #include <sys/time.h>
 #include <fcntl.h>
 #include <errno.h>
+#include "i2c_bus.h"
+#include "i2c_task.h"
 
 #define EEPROM_24XX02_WRITE_CYCLE_TIME_MAX	5000 // us 
 
@@ -38,30 +40,44 @@ int eeprom_24xx02_functionality(int fd){
  	return 0;
 }
 
-int eeprom_24xx02_write_byte(int fd, int addr, __u8 reg, __u8 val){
+/*Byte write as a task: t->val to t->reg, then yield for the write cycle*/
+int eeprom_24xx02_write_step(struct i2c_task *t){
 	
 	int ret;
 	
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if(t->state == 1)
+		return I2C_TASK_DONE;
+
+	if( i2c_set_slave(t->fd, t->addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
-		return EXIT_FAILURE;
+		return -1;
 	}
 
-	ret = i2c_smbus_write_byte_data(fd, reg, val);
+	ret = i2c_smbus_write_byte_data(t->fd, t->reg, t->val);
 	if(ret < 0){
 		printf("Failed to write byte; %s\n", strerror(errno));
-		return ret;	
+		return -1;	
 	}
 	
-	usleep(EEPROM_24XX02_WRITE_CYCLE_TIME_MAX);
+	t->state = 1;
+	return EEPROM_24XX02_WRITE_CYCLE_TIME_MAX;
+}
+
+int eeprom_24xx02_write_byte(int fd, int addr, __u8 reg, __u8 val){
+	
+	struct i2c_task t;
+	
+	i2c_task_init(&t, eeprom_24xx02_write_step, fd, addr, NULL);
+	t.reg = reg;
+	t.val = val;
 	
-	return ret;
+	return i2c_task_run1(&t) < 0 ? EXIT_FAILURE : 0;
 }
 
 
 int eeprom_24xx02_read_byte(int fd, int addr, __u8 reg){
 
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
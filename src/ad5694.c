@@ -14,6 +14,7 @@
 #include <linux/i2c-dev.h>
 #include <errno.h>
 #include <linux/swab.h>
+#include "i2c_bus.h"
 
 /* DAC AD5694 Definitions */
 //Command Definitions
@@ -28,6 +29,7 @@
 //...										//Reserved
 #define AD5694_RESERVED9			0x0F	//Reserved
 #define AD5694_NCH					8
+#define AD5694_DAC_ALL				0x0f	//DAC select bits of A..D
 
 const int ad5694_addr_low = 0x0c;
 const int ad5694_addr_high = 0x0f;
@@ -60,7 +62,7 @@ int ad5694_functionality(int fd){
 }
 
 int ad5694_read_ch(int fd, int addr, __u8 reg){
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -73,47 +75,89 @@ int ad5694_read_ch(int fd, int addr, __u8 reg){
 	return AD5694_REG_TO_VAL(__swab16(i2c_smbus_read_word_data(fd, 1<<reg)));
 }
 
-int ad5694_read_all(int fd, int addr, __u16 data[AD5694_NCH]){
+/*Queue the read backs of the channels in mask, they go out with the next
+  i2c_batch_flush()*/
+int ad5694_queue_ch(struct i2c_batch *b, int addr, unsigned mask, 
+											__u16 data[AD5694_NCH]){
 	int ch;
-	for(ch=0;ch<AD5694_NCH; ch++)
-		data[ch] = ad5694_read_ch(fd, addr, ch);
-
+	for(ch=0;ch<AD5694_NCH; ch++){
+		if(!(mask & (1u << ch)))
+			continue;
+		if(i2c_batch_read_word(b, addr, 1<<ch, &data[ch], 4) < 0)
+			return -1;
+	}
 	return 0;
 }
 
-void ad5694_print_val(__u16 val[AD5694_NCH], float lsb, float *conv_param, 
-													char *data_type[8], int i, 
-													int log, int log_p){
-	int ch;
-	if(!log)
-		printf("-----DAC------\n");
-	for(ch=0;ch<2; ch++){
-		if(log){
-			char str[16];
-			sprintf(str,"%0.3f ", val[ch]*lsb*conv_param[ch]);
-			write(log_p, str, strlen(str));
-		}
-		else
-			printf("%s: %0.3f %s\n", data_type[ch], val[ch]*lsb*conv_param[ch], (ch==1?"uA":"kV"));
-	}
+int ad5694_queue_all(struct i2c_batch *b, int addr, __u16 data[AD5694_NCH]){
+	return ad5694_queue_ch(b, addr, 0xff, data);
+}
+
+int ad5694_read_all(int fd, int addr, __u16 data[AD5694_NCH]){
+	struct i2c_batch *b;
+
+	if((b = i2c_bus_batch(fd)) == NULL || ad5694_queue_all(b, addr, data) < 0)
+		return -1;
+	return i2c_batch_flush(b);
 }
 
+/*0 once written, -1 on any error*/
 int ad5694_write_ch(int fd, int addr, __u8 ch, __u16 val){
-	if(ch > 8){
-	printf("Error: wrong channel\n");
-		return EXIT_FAILURE;
+	if(!(AD5694_DAC_ALL & (1u << ch))){	//A..D
+		fprintf(stderr, "Error: wrong channel\n");
+		return -1;
 	}
 	
 	__u8 reg = (AD5694_CHANNEL_WRITE_UPDATE<<4)|(1<<ch);
 	
-	if( ioctl(fd, I2C_SLAVE, addr) < 0){
-		printf("Failed to configure the device; %s\n", strerror(errno));
-		return EXIT_FAILURE;
+	if( i2c_set_slave(fd, addr) < 0){
+		fprintf(stderr, "Failed to configure the device; %s\n", 
+															strerror(errno));
+		return -1;
 	}
 
 	return i2c_smbus_write_word_data(fd, reg, __swab16(AD5694_VAL_TO_REG(val)));
 }
 
+/*
+*	Staged update: the new values go to the input registers (the outputs
+*	don't move) and one update command copies them to the DAC registers
+*	of all the channels of its mask at once. The LDAC mask comes first:
+*	with the LDAC pin held low a staged write would update its channel
+*	on the spot. Queued, they go out with the next i2c_batch_flush().
+*/
+int ad5694_queue_ldac_mask(struct i2c_batch *b, int addr, __u8 mask){
+	return i2c_batch_write_word(b, addr, AD5694_MASK_LDAC_PIN<<4, mask);
+}
+
+int ad5694_queue_stage(struct i2c_batch *b, int addr, __u8 ch, __u16 val){
+	if(ch > 3){
+		printf("Error: wrong channel\n");
+		return -1;
+	}
+	return i2c_batch_write_word(b, addr, (AD5694_INPUT_REG_WRITE<<4)|(1<<ch),
+													AD5694_VAL_TO_REG(val));
+}
+
+int ad5694_queue_update(struct i2c_batch *b, int addr, __u8 mask){
+	return i2c_batch_write_word(b, addr, 
+					(AD5694_INPUT_REG_UPDATE<<4)|(mask & AD5694_DAC_ALL), 0);
+}
+
+/*The channels of mask to val[ch], their outputs changing together*/
+int ad5694_queue_setpoint(struct i2c_batch *b, int addr, __u8 mask, 
+														const __u16 val[4]){
+	int ch;
+
+	if(ad5694_queue_ldac_mask(b, addr, AD5694_DAC_ALL) < 0)
+		return -1;
+	for(ch=0; ch<4; ch++){
+		if((mask & (1 << ch)) && ad5694_queue_stage(b, addr, ch, val[ch]) < 0)
+			return -1;
+	}
+	return ad5694_queue_update(b, addr, mask);
+}
+
 /*
 *
 *		APPLICATION
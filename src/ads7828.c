@@ -14,6 +14,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <linux/swab.h>
+#include "i2c_bus.h"
 
 /* The ADS7828 registers */
 #define ADS7828_NCH             8       /* 8 channels supported */
@@ -53,7 +54,7 @@ int ads7828_functionality(int fd){
 }
 
 int ads7828_read_ch(int fd, int addr, int ch){
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -68,36 +69,32 @@ int ads7828_read_ch(int fd, int addr, int ch){
 														ADS7828_CMD_PD1, ch)));
 }
 
-int ads7828_read_all(int fd, int addr, __u16 data[ADS7828_NCH]){
+/*Queue the conversions of the channels in mask, they go out with the 
+  next i2c_batch_flush(), the others are left as they are*/
+int ads7828_queue_ch(struct i2c_batch *b, int addr, unsigned mask, 
+											__u16 data[ADS7828_NCH]){
 	int ch;
-	for(ch=0; ch<ADS7828_NCH; ch++)
-		data[ch] = ads7828_read_ch(fd, addr, ch);
-
+	for(ch=0; ch<ADS7828_NCH; ch++){
+		if(!(mask & (1u << ch)))
+			continue;
+		if(i2c_batch_read_word(b, addr, ads7828_cmd_byte(ADS7828_CMD_SD_SE|
+											ADS7828_CMD_PD1, ch), 
+											&data[ch], 0) < 0)
+			return -1;
+	}
 	return 0;
 }
 
-void ads7828_print_val(__u16 val[ADS7828_NCH], float lsb, float *conv_param, 
-												  char *data_type[ADS7828_NCH],
-												     int i, int log, int log_p){
-	int ch; char str[16];
-	if(!log)
-		printf("-----ADC------\n");
-	for(ch=0;ch<8; ch++){
-		if(log){
-			sprintf(str, "%0.3f ", val[ch]*lsb*conv_param[ch]);
-			write( log_p, str, strlen(str) );
-		}
-		else{	
-			if(ch==4)
-				printf("%s: %0.3f nA\n", data_type[ch], val[ch]*lsb*conv_param[ch]);
-			else if(ch==5)
-				printf("%s: %0.3f V\n", data_type[ch], val[ch]*lsb*conv_param[ch]);
-			else if(ch==0 || ch==1 || ch==7)
-				printf("%s: %0.3f uA\n", data_type[ch], val[ch]*lsb*conv_param[ch]);
-			else
-				printf("%s: %0.3f kV\n", data_type[ch], val[ch]*lsb*conv_param[ch]);
-		}
-	}
+int ads7828_queue_all(struct i2c_batch *b, int addr, __u16 data[ADS7828_NCH]){
+	return ads7828_queue_ch(b, addr, 0xff, data);
+}
+
+int ads7828_read_all(int fd, int addr, __u16 data[ADS7828_NCH]){
+	struct i2c_batch *b;
+
+	if((b = i2c_bus_batch(fd)) == NULL || ads7828_queue_all(b, addr, data) < 0)
+		return -1;
+	return i2c_batch_flush(b);
 }
 
 /*
@@ -0,0 +1,81 @@
+/*
+*	binlog.c -	Binary log of the raw device codes, see binlog.h.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "binlog.h"
+
+typedef char binlog_rec_size_check[sizeof(struct binlog_rec) ==
+												BINLOG_REC_SIZE ? 1 : -1];
+
+/*CRC-32 (IEEE 802.3, reflected 0xEDB88320), as zlib's crc32()*/
+__u32 binlog_crc32(const void *buf, size_t len){
+	static __u32 table[256];
+	static int table_ok = 0;
+	const __u8 *p = buf;
+	__u32 crc = 0xffffffff;
+	__u32 c; int i; int bit;
+
+	if(!table_ok){		//same contents from any thread, no lock needed
+		for(i=0; i<256; i++){
+			c = i;
+			for(bit=0; bit<8; bit++)
+				c = c & 1 ? (c >> 1) ^ 0xedb88320 : c >> 1;
+			table[i] = c;
+		}
+		table_ok = 1;
+	}
+	while(len--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffff;
+}
+
+__u64 binlog_now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return (__u64)t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+void binlog_fill(struct binlog_rec *r, int dev, int inst, int adapter,
+										int addr, __u64 ts, __u16 val[8]){
+	r->dev = dev;
+	r->inst = inst;
+	r->adapter = adapter;
+	r->addr = addr;
+	r->ts = ts;
+	if(val)
+		memcpy(r->val, val, sizeof(r->val));
+	else
+		memset(r->val, 0, sizeof(r->val));
+	r->crc = binlog_crc32(r, offsetof(struct binlog_rec, crc));
+}
+
+/*1 if the record is intact*/
+int binlog_check(struct binlog_rec *r){
+	return r->crc == binlog_crc32(r, offsetof(struct binlog_rec, crc));
+}
+
+/*Reads up to n whole records, returns their number, 0 at the end*/
+int binlog_read(int fd, struct binlog_rec *r, int n){
+	size_t len = (size_t)n*BINLOG_REC_SIZE;
+	size_t got = 0;
+	ssize_t ret;
+
+	while(got < len){
+		ret = read(fd, (char*)r + got, len - got);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret < 0){
+			fprintf(stderr, "Error: binary log read; %s\n", strerror(errno));
+			return -1;
+		}
+		if(ret == 0)
+			break;
+		got += ret;
+	}
+	return got / BINLOG_REC_SIZE;
+}
@@ -0,0 +1,48 @@
+#ifndef __BINLOG_H__
+#define __BINLOG_H__
+/*
+*	binlog.h -	Binary log of the raw device codes.
+*
+*	The file is a plain sequence of fixed-size records, appended through
+*	a logwr with rec_size set. No header, no index: a record is found at
+*	offset k*BINLOG_REC_SIZE and a torn tail (power cut in the middle of
+*	a write) is cut back to the last whole record when the file is 
+*	reopened. The codes are stored as read from the devices, conversion
+*	to engineering units is done when the log is read back. Fields are
+*	in host (little-endian) order.
+*/
+#include <stddef.h>
+#include <linux/types.h>
+
+/*Device ids, stable: they are stored in the files*/
+#define BINLOG_ADS7828		1
+#define BINLOG_AD5694		2
+#define BINLOG_MCP23009		3
+#define BINLOG_TMP75		4
+#define BINLOG_SHT21		5
+#define BINLOG_MPL115		6
+#define BINLOG_DAC7578		7
+
+#define BINLOG_BUSY			0x80	//addr flag: claimed by a kernel driver
+
+/*Every field naturally aligned, no padding: 32 bytes*/
+struct binlog_rec{
+	__u64 ts;				//ns since the epoch (CLOCK_REALTIME)
+	__u8 dev;				//BINLOG_* device id
+	__u8 inst;				//instance of the device on its bus
+	__u8 adapter;			//i2c-N
+	__u8 addr;				//7-bit address | BINLOG_BUSY
+	__u16 val[8];			//raw codes
+	__u32 crc;				//CRC-32 of the bytes above
+};
+
+#define BINLOG_REC_SIZE		32
+
+__u32 binlog_crc32(const void *buf, size_t len);
+__u64 binlog_now(void);
+void binlog_fill(struct binlog_rec *r, int dev, int inst, int adapter,
+										int addr, __u64 ts, __u16 val[8]);
+int binlog_check(struct binlog_rec *r);
+int binlog_read(int fd, struct binlog_rec *r, int n);
+
+#endif
@@ -0,0 +1,22 @@
+/*
+*	conv.c -	Raw code to engineering unit conversion, see conv.h.
+*/
+#include "conv.h"
+
+/*Builds the vector table of a device, offset may be NULL, mask 0 is all*/
+void conv_init(struct conv_tab *t, float lsb, const float gain[8],
+				const float offset[8], __u16 mask, int code_signed){
+	int ch;
+
+	for(ch=0; ch<8; ch++){
+		t->gain[ch] = lsb * gain[ch];
+		t->offset[ch] = offset ? offset[ch] : 0;
+		t->mask[ch] = mask ? mask : 0xffff;
+	}
+	t->code_signed = code_signed;
+}
+
+/*A single value, e.g. an aggregate of codes (already signed if need be)*/
+float conv_unit(const struct conv_tab *t, int ch, float code){
+	return code * t->gain[ch] + t->offset[ch];
+}
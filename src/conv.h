@@ -0,0 +1,46 @@
+#ifndef __CONV_H__
+#define __CONV_H__
+/*
+*	conv.h -	Raw code to engineering unit conversion.
+*
+*	Every channel is linear: unit = code * lsb * gain[ch] + offset[ch],
+*	the code masked and, for the signed devices, taken as __s16. The
+*	8 channels of a device are converted at once as a vector of floats
+*	(GCC vector extensions: NEON on the Pi, SSE on a PC), so a snapshot
+*	costs one multiply-add per device whatever its channel count.
+*/
+#include <string.h>
+#include <linux/types.h>
+
+typedef __u16 conv_v8hu __attribute__((vector_size(16)));
+typedef __s16 conv_v8hi __attribute__((vector_size(16)));
+typedef float conv_v8sf __attribute__((vector_size(32)));
+
+struct conv_tab{
+	conv_v8sf gain;			//lsb * gain[ch]
+	conv_v8sf offset;
+	conv_v8hu mask;
+	int code_signed;
+};
+
+void conv_init(struct conv_tab *t, float lsb, const float gain[8],
+				const float offset[8], __u16 mask, int code_signed);
+float conv_unit(const struct conv_tab *t, int ch, float code);
+
+/*Converts the 8 codes of a device in one pass*/
+static inline void conv_snapshot(const struct conv_tab *t,
+										const __u16 val[8], float unit[8]){
+	conv_v8hu v;
+	conv_v8sf f;
+
+	memcpy(&v, val, sizeof(v));
+	v &= t->mask;
+	if(t->code_signed)
+		f = __builtin_convertvector((conv_v8hi)v, conv_v8sf);
+	else
+		f = __builtin_convertvector(v, conv_v8sf);
+	f = f * t->gain + t->offset;
+	memcpy(unit, &f, sizeof(f));
+}
+
+#endif
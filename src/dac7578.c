@@ -13,7 +13,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
 #include <linux/swab.h>
+#include "i2c_bus.h"
+#include "pca9541.h"
 
 //DAC7578 Command definitions
 //Power Commmads
@@ -53,6 +56,8 @@
 #define DAC7578_CH_ALL		0xf
 
 const int dac7578_addr_list[4] = {0x48, 0x4a, 0x4c, '\0'};
+//PCA9541 master selector of each board, by board_num (D..A)
+const int prec_mast_sel[5] = {0, 0x78, 0x74, 0x72, 0x71};
 
 static inline __u16 DAC7875_VAL_TO_REG(int val){
 	return val<<4;
@@ -63,7 +68,7 @@ static inline int DAC7875_REG_TO_VAL(__u16 reg){
 }
 
 int dac7578_read_reg(int fd, int addr, __u8 reg){
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -78,7 +83,7 @@ int dac7578_read_reg(int fd, int addr, __u8 reg){
 }
 
 int dac7578_read_ch(int fd, int addr, int ch){
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -92,8 +97,19 @@ int dac7578_read_ch(int fd, int addr, int ch){
 	return DAC7875_REG_TO_VAL(__swab16(i2c_smbus_read_word_data(fd, reg)));
 }
 
+/*Queue the read back of channel ch, it goes out with the next 
+  i2c_batch_flush()*/
+int dac7578_queue_ch(struct i2c_batch *b, int addr, int ch, __u16 *data){
+	if(ch < DAC7578_CH_A || ch > DAC7578_CH_H){
+		printf("Error: attempt to read an invalid channel\n");
+		return -1;
+	}
+	return i2c_batch_read_word(b, addr, (DAC7578_REG_CH_READ<<4)|((__u8)ch),
+																data, 4);
+}
+
 int dac7875_write_reg(int fd, int addr, int reg, __u16 val){
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -109,7 +125,7 @@ int dac7875_write_reg(int fd, int addr, int reg, __u16 val){
 }
 
 int dac7875_write_ch(int fd, int addr, int ch, __u16 val){
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -129,29 +145,128 @@ __u16 val_to_dac(float val, float lsb){	//val can be: vset in kV or ilim in uA
 	return (__u16) (val/lsb + 0.5);		//float to int rounding conversion;
 }
 
-int get_addr(int fd, const int *list){
-	int i; 
-	int ret = -1;
-	for(i=0; list[i]!='\0'; i++){
-		if(ioctl(fd, I2C_SLAVE, list[i]) < 0) {
-			if (errno == EBUSY) {
+static struct i2c_cache cache;
+
+int get_addr(int fd, int adapter, const int *list){
+	int i; int n;
+	int addr[4]; int busy[4];
+
+	n = i2c_cache_find(&cache, fd, adapter, "dac7578", list, addr, busy, 4);
+	for(i=0; i<n; i++){
+		if(!busy[i])
+			return addr[i];
+	}
+	return -1;
+}
+
+/*First DAC answering on a bus we own (no cache: the boards share it)*/
+int probe_addr(int fd, const int *list){
+	for(; *list; list++){
+		if(i2c_probe(fd, *list) == I2C_PROBE_PRESENT)
+			return *list;
+	}
+	return -1;
+}
+
+/*
+*	Threshold table: one line per board, "A 10 10 12.5 10 10 10 10 10",
+*	mV of channels 0-7, "-" keeps a channel as it is. # starts a comment.
+*	Returns the number of boards, their channels in mask[board].
+*/
+int read_table(const char *path, float thr[5][8], unsigned mask[5]){
+	char line[256];
+	char *tok; char *end;
+	int board; int ch; int n = 0; int nline = 0;
+	FILE *fp;
+
+	if((fp = fopen(path, "r")) == NULL){
+		fprintf(stderr, "Error: can't open %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+	memset(mask, 0, 5 * sizeof(mask[0]));
+	while(fgets(line, sizeof(line), fp)){
+		nline++;
+		line[strcspn(line, "#\r\n")] = '\0';
+		if((tok = strtok(line, " \t")) == NULL)
+			continue;
+		if(tok[1] != '\0' || tok[0] < 'A' || tok[0] > 'D'){
+			fprintf(stderr, "Error: %s:%d: no PREC %s\n", path, nline, tok);
+			goto ERR;
+		}
+		board = 69 - tok[0];
+		if(mask[board]){
+			fprintf(stderr, "Error: %s:%d: PREC %s twice\n", path, nline, tok);
+			goto ERR;
+		}
+		for(ch=0; ch<8 && (tok = strtok(NULL, " \t")); ch++){
+			if(!strcmp(tok, "-"))
 				continue;
-			} else {
-				fprintf(stderr, "Error: Could not set address to 0x%02x: %s\n",
-															list[i],
-					 				                      	strerror(errno));
-				return EXIT_FAILURE;
+			thr[board][ch] = strtof(tok, &end);
+			if(*end || end == tok || thr[board][ch] < 0 || 
+												thr[board][ch] > 400){
+				fprintf(stderr, "Error: %s:%d: threshold %s, 0 to 400 mV\n",
+														path, nline, tok);
+				goto ERR;
 			}
+			mask[board] |= 1u << ch;
+		}
+		if(ch < 8 || strtok(NULL, " \t")){
+			fprintf(stderr, "Error: %s:%d: 8 channels per PREC\n", path, 
+																	nline);
+			goto ERR;
 		}
+		n++;
+	}
+	fclose(fp);
+	return n;
+ERR:
+	fclose(fp);
+	return -1;
+}
 
-		if(i2c_smbus_write_quick(fd, I2C_SMBUS_WRITE) < 0)
+/*
+*	The channels of mask to their input registers, one update of all of
+*	them, and every channel read back: one transfer (25 messages). The
+*	update copies the input registers of the other channels as well, they
+*	hold the last value written to them. Returns the channels that read
+*	back something else, -1 if the transfer failed.
+*/
+int bulk_board(int fd, int addr, int board, const float thr[8], 
+												unsigned mask, float lsb){
+	static struct i2c_batch batch;
+	__u16 code[8]; __u16 data[8];
+	int ch; int diff = 0;
+
+	i2c_batch_init(&batch, fd);
+	for(ch=DAC7578_CH_A; ch<=DAC7578_CH_H; ch++){
+		if(!(mask & (1u << ch)))
 			continue;
-		else{
-			ret = list[i];
-			break;
-		}
+		code[ch] = val_to_dac(thr[ch], lsb);
+		i2c_batch_write_word(&batch, addr, 
+						(DAC7578_REG_INPUT_CH_WRITE<<4)|((__u8)ch), 
+											DAC7875_VAL_TO_REG(code[ch]));
+	}
+	i2c_batch_write_word(&batch, addr, 
+				(DAC7578_REG_INPUT_CH_UPDATE<<4)|DAC7578_CH_ALL, 0);
+	for(ch=DAC7578_CH_A; ch<=DAC7578_CH_H; ch++)
+		dac7578_queue_ch(&batch, addr, ch, &data[ch]);
+	if(i2c_batch_flush(&batch) < 0){
+		printf("PREC %c: failed transfer; %s\n", (char)(69 - board), 
+															strerror(errno));
+		return -1;
+	}
+
+	for(ch=DAC7578_CH_A; ch<=DAC7578_CH_H; ch++){
+		if(!(mask & (1u << ch)) || data[ch] == code[ch])
+			continue;
+		printf("PREC %c Ch %i: wrote %0.1f mV, reads %0.1f mV\n", 
+					(char)(69 - board), ch, code[ch]*lsb, data[ch]*lsb);
+		diff++;
 	}
-	return ret;
+	ch = __builtin_popcount(mask);
+	printf("PREC %c: %d channels written, %d verified\n", (char)(69 - board),
+															ch, ch - diff);
+	return diff;
 }
 
 static void help(void){
@@ -176,6 +291,14 @@ static void help(void){
 "                  PREC D\n\n"
 "     -all\n"
 "                  All PREC \n\n"
+"     -f (file)\n"
+"                  Threshold table, a line per PREC: \"A mV mV ... mV\",\n"
+"                  8 channels, - keeps one. Written, updated at once and\n"
+"                  read back, one transfer per PREC\n\n"
+"     -M\n"
+"                  Arbitrate the PREC master selectors (PCA9541) here,\n"
+"                  once per board, on i2c-(bus_number+2): the kernel\n"
+"                  pca9541 driver must be unbound\n\n"
 "     -h\n"
 "                  Help menu\n\n");
 
@@ -185,7 +308,6 @@ int main(int argc, char *argv[]){
 	int fd = 0;
 	int board_num = -1;
 	int counter = 0;
-	char filename[20];
 	float lsb = 0.097680; //mV   
 	int addr;
 	int flags = 0; 
@@ -193,6 +315,10 @@ int main(int argc, char *argv[]){
 	int ch = -1;
 	float val = -1;
 	int hlp = 0;
+	int arb = 0;
+	const char *table = NULL;
+	static float thr[5][8];
+	unsigned thr_mask[5] = {0};
 	int bus_offset = 2;
 	while(1+flags < argc && argv[1+flags][0] == '-'){
 	    switch(argv[1+flags][1]){
@@ -227,6 +353,17 @@ int main(int argc, char *argv[]){
 			case 'a'://all boards
 					counter = 4;
 					break;
+			case 'f'://threshold table
+					if(2+flags >= argc){
+						help();
+						return EXIT_FAILURE;
+					}
+					table = argv[2+flags];
+					flags++;
+					break;
+			case 'M'://master selector arbitration in user space
+					arb = 1;
+					break;
 			case 'h': 
 					hlp = 1;
 					break;
@@ -248,65 +385,119 @@ int main(int argc, char *argv[]){
 		return EXIT_FAILURE;
 	}
 
+	if(table){				//the boards of the table
+		if(read_table(table, thr, thr_mask) < 0)
+			return EXIT_FAILURE;
+		board_num = -1;
+		counter = 4;
+	}
+
 	if(counter == 0){
 		printf("Error: must define a target PREC\n");
 		return EXIT_FAILURE;
 	}
 
-	int bus_eff;
-	for(; counter > 0; counter--){
+	if(ch < -1 || ch > 7){
+		fprintf(stderr, "Error: wrong channel\n");
+		return EXIT_FAILURE;
+	}
 
-		bus_eff = bus + bus_offset + (board_num==-1?counter:board_num);
-		snprintf(filename, 19, "/dev/i2c-%d", bus_eff);
+	if(val != -1 && (val < 0 || val > 400)){
+		printf("Error: wrong threshold. Must be between 0 and 400 mV\n");
+		return EXIT_FAILURE;
+	}
 
-		if((fd = open(filename, O_RDWR)) < 0){
+	int bus_eff; int board; int res = 0;
+	int diff = 0; int ret;
+	static struct i2c_batch batch;
+	struct pca9541 sel;
+	struct timespec t0; struct timespec t1;
+	__u16 data[8];
+	i2c_cache_load(&cache, I2C_CACHE_FILE);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(; counter > 0 && res == 0; counter--){
+		board = board_num==-1?counter:board_num;
+		if(table && !thr_mask[board])
+			continue;
+		//-M: the boards are reached from the upstream adapter, not through
+		//the child adapters of the kernel pca9541 driver
+		bus_eff = bus + bus_offset + (arb ? 0 : board);
+		if((fd = i2c_bus_open(bus_eff)) < 0){
 			printf("Failed to open the bus (adapter) %d; %s\n", bus,
 															   strerror(errno));
 			return EXIT_FAILURE;
 		}
 
-		if((addr = get_addr(fd, dac7578_addr_list)) < 0){
-			printf("Device not present; %s\n", strerror(errno));
-			return EXIT_FAILURE;
+		if(arb){
+			if(pca9541_open(&sel, fd, bus_eff, prec_mast_sel[board]) < 0 ||
+											pca9541_acquire(&sel) < 0){
+				pca9541_close(&sel);
+				i2c_bus_close(fd);
+				return EXIT_FAILURE;
+			}
+			addr = probe_addr(fd, dac7578_addr_list);
 		}
+		else
+			addr = get_addr(fd, bus_eff, dac7578_addr_list);
 
-		if(ch < -1 || ch > 7){
-			fprintf(stderr, "Error: wrong channel\n");
-			return EXIT_FAILURE;
+		if(addr < 0){
+			printf("Device not present; %s\n", strerror(errno));
+			res = EXIT_FAILURE;
 		}
-
-		if(val == -1){	//Then read
-			__u16 data = 0;
-			if(ch == -1){	//Read all
-				int ch_i;
-				printf("PREC %c thresholds\n", 
-								(char)(69 - (board_num==-1?counter:board_num)));
-				for(ch_i=DAC7578_CH_A; ch_i<=DAC7578_CH_H; ch_i++){
-					data = dac7578_read_ch(fd, addr, ch_i);
-					printf("Ch %i: %0.1f mV\n", ch_i, data*lsb);
-				}
+		else if(table){
+			if((ret = bulk_board(fd, addr, board, thr[board], 
+								thr_mask[board], lsb)) < 0)
+				res = EXIT_FAILURE;
+			else
+				diff += ret;
+		}
+		else if(val == -1){	//Then read, all the channels in one transfer
+			int ch_i;
+			i2c_batch_init(&batch, fd);
+			for(ch_i=DAC7578_CH_A; ch_i<=DAC7578_CH_H; ch_i++){
+				if(ch == -1 || ch == ch_i)
+					dac7578_queue_ch(&batch, addr, ch_i, &data[ch_i]);
 			}
-			else{	//Read ch
-				data = dac7578_read_ch(fd, addr, ch);
-				printf("Ch %i: %0.1f mV\n", ch, data*lsb);
+			if(i2c_batch_flush(&batch) < 0){
+				printf("Failed to read the thresholds; %s\n", strerror(errno));
+				res = EXIT_FAILURE;
 			}
-			//goto OUT;
-			continue;
+			else if(ch == -1){	//Read all
+				printf("PREC %c thresholds\n", (char)(69 - board));
+				for(ch_i=DAC7578_CH_A; ch_i<=DAC7578_CH_H; ch_i++)
+					printf("Ch %i: %0.1f mV\n", ch_i, data[ch_i]*lsb);
+			}
+			else	//Read ch
+				printf("Ch %i: %0.1f mV\n", ch, data[ch]*lsb);
 		}
+		else{
+			__u16 dac_val = val_to_dac(val, lsb);
 
-		if (val < 0 || val > 400){
-			printf("Error: wrong threshold. Must be between 0 and 400 mV\n");
-			return EXIT_FAILURE;
+			if(ch == -1)
+				dac7875_write_ch(fd, addr, DAC7578_CH_ALL, dac_val);
+			else
+				dac7875_write_ch(fd, addr, ch, dac_val);
 		}
 
-		__u16 dac_val = val_to_dac(val, lsb);
+		if(arb){
+			pca9541_release(&sel);
+			fprintf(stderr, "PREC %c: bus owned after %0.3f ms%s\n", 
+					(char)(69 - board), sel.wait_ns/1e6, 
+					sel.forced ? ", taken from the other master" : "");
+			pca9541_close(&sel);
+		}
+		i2c_bus_close(fd);
+	}
 
-		if(ch == -1)
-			dac7875_write_ch(fd, addr, DAC7578_CH_ALL, dac_val);
-		else
-			dac7875_write_ch(fd, addr, ch, dac_val);
+	if(table){
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		printf("Table %s: %0.3f ms, %d channels differ\n", table, 
+				(t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)/1e6,
+																	diff);
+		if(diff)
+			res = EXIT_FAILURE;
 	}
 
-	//OUT:
-	return 0;
+	i2c_cache_save(&cache, I2C_CACHE_FILE);
+	return res;
 }
@@ -0,0 +1,96 @@
+/*
+*	gpio_line.c -	Edges of one GPIO line, see gpio_line.h.
+*
+*	The line is requested with GPIO_V2_GET_LINE_IOCTL, the kernel queues
+*	the edges with their timestamps taken in the interrupt handler: a
+*	change is timed to the microsecond even when the reader is late. The
+*	simulated chips of gpio-sim are plain gpiochips, the same code runs
+*	on them (see README).
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "gpio_line.h"
+
+/*spec is "CHIP:LINE", CHIP a gpiochip name or number*/
+int gpio_line_open(struct gpio_line *l, const char *spec,
+													const char *consumer){
+	struct gpio_v2_line_request req;
+	char path[64];
+	const char *colon;
+	int cfd;
+
+	memset(l, 0, sizeof(*l));
+	l->fd = -1;
+	if((colon = strchr(spec, ':')) == NULL || colon == spec ||
+						colon - spec >= (int)sizeof(l->chip) || !colon[1]){
+		fprintf(stderr, "Error: bad GPIO line \"%s\", CHIP:LINE\n", spec);
+		return -1;
+	}
+	memcpy(l->chip, spec, colon - spec);
+	l->line = atoi(colon + 1);
+	if(l->chip[0] >= '0' && l->chip[0] <= '9')
+		snprintf(path, sizeof(path), "/dev/gpiochip%s", l->chip);
+	else
+		snprintf(path, sizeof(path), "/dev/%s", l->chip);
+	if((cfd = open(path, O_RDONLY | O_CLOEXEC)) < 0){
+		fprintf(stderr, "Error: can't open %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = l->line;
+	req.num_lines = 1;
+	strncpy(req.consumer, consumer, sizeof(req.consumer) - 1);
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+					   GPIO_V2_LINE_FLAG_EDGE_FALLING |
+					   GPIO_V2_LINE_FLAG_BIAS_PULL_UP |
+					   GPIO_V2_LINE_FLAG_EVENT_CLOCK_REALTIME;
+	if(ioctl(cfd, GPIO_V2_GET_LINE_IOCTL, &req) < 0){
+		fprintf(stderr, "Error: can't request %s line %d; %s\n", path,
+												l->line, strerror(errno));
+		close(cfd);
+		return -1;
+	}
+	close(cfd);
+	l->fd = req.fd;
+	return 0;
+}
+
+/*1 and the time of the edge, 0 after timeout_ms without one, -1 on error*/
+int gpio_line_wait(struct gpio_line *l, int timeout_ms, __u64 *ts){
+	struct gpio_v2_line_event ev[16];
+	struct pollfd pfd = {.fd = l->fd, .events = POLLIN};
+	ssize_t n;
+	int ret;
+
+	if((ret = poll(&pfd, 1, timeout_ms)) <= 0)
+		return ret < 0 && errno != EINTR ? -1 : 0;
+	//a burst is one interrupt of the expander, the first edge dates it
+	if((n = read(l->fd, ev, sizeof(ev))) < (ssize_t)sizeof(ev[0]))
+		return n < 0 && errno != EINTR ? -1 : 0;
+	l->edges += n / sizeof(ev[0]);
+	*ts = ev[0].timestamp_ns;
+	return 1;
+}
+
+/*Level of the line, 0 while the interrupt is asserted*/
+int gpio_line_get(struct gpio_line *l){
+	struct gpio_v2_line_values val = {.bits = 0, .mask = 1};
+
+	if(ioctl(l->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &val) < 0)
+		return -1;
+	return val.bits & 1;
+}
+
+void gpio_line_close(struct gpio_line *l){
+	if(l->fd >= 0)
+		close(l->fd);
+	l->fd = -1;
+}
@@ -0,0 +1,24 @@
+#ifndef __GPIO_LINE_H__
+#define __GPIO_LINE_H__
+/*
+*	gpio_line.h -	Edges of one GPIO line through the GPIO character
+*					device (uAPI v2).
+*/
+#include <linux/types.h>
+
+/* An active low interrupt line: input, pull-up bias, falling edges,
+   timestamps on CLOCK_REALTIME ns. */
+struct gpio_line{
+	int fd;					//line request fd
+	int line;
+	char chip[32];
+	unsigned long edges;
+};
+
+int gpio_line_open(struct gpio_line *l, const char *spec,
+													const char *consumer);
+int gpio_line_wait(struct gpio_line *l, int timeout_ms, __u64 *ts);
+int gpio_line_get(struct gpio_line *l);
+void gpio_line_close(struct gpio_line *l);
+
+#endif
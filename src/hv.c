@@ -5,11 +5,21 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <linux/i2c-dev.h>
 #include "func_reg.h"
 #include "mcp23009.h"
+#include "i2c_bus.h"
+#include "logwr.h"
+#include "conv.h"
+#include "render.h"
+#include "binlog.h"
+#include "stream.h"
+#include "ramp.h"
+#include "trip.h"
+#include "gpio_line.h"
 
 #define BUS_NUM_LOW		0
 #define BUS_NUM_HIGH	4
@@ -18,6 +28,8 @@
 #define AD5694_ADDR_HIGH	0x0F
 #define MCP23009_ADDR_LOW	0x20
 #define MCP23009_ADDR_HIGH	0x27
+#define HV_INPUTS			MCP23009_HV_IODIR	//D0-D2, D4 inputs
+#define WATCH_POLL_MS		10		//input polling without an INT line
 #define Vref		4.53 			//(V)
 
 static const float LSB = Vref/4096; // ( V/bit)
@@ -28,10 +40,14 @@ struct device{
 	int addr_low;
 	int addr_high;
 	int (*read_val)(int, int, __u16[8]);
-	void (*print_val)(__u16[8], float, float*, char*[8], int, int, int);
+	const char *title;			//text layout, see render.h
+	char *unit_name[8];
+	int nch;
+	int bits;
 	__u16 val[8];
 	float lsb;
 	float conv_param[8];
+	struct conv_tab conv;
 };
 
 struct device hv_dev_list[4] = {
@@ -40,7 +56,9 @@ struct device hv_dev_list[4] = {
 	 .addr_low  = 0x48,
 	 .addr_high = 0x4b,
 	 .read_val  = ads7828_read_all, 
-	 .print_val = ads7828_print_val, 
+	 .title     = "-----ADC------",
+	 .unit_name = {"uA","uA","kV","kV","nA","V","kV","uA"},
+	 .nch       = 8,
 	 .lsb = 4.53/4096, 
 	 .conv_param = {2, 2, 2, 2, 400, 1, 2, 2}, }, //unit conversion parameters
 	{.name      = "ad5694",
@@ -48,7 +66,9 @@ struct device hv_dev_list[4] = {
 	 .addr_low  = 0x0c,
 	 .addr_high = 0x0f,
 	 .read_val  = ad5694_read_all, 
-	 .print_val = ad5694_print_val, 
+	 .title     = "-----DAC------",
+	 .unit_name = {"kV","uA"},
+	 .nch       = 2,
 	 .lsb = 4.53/4096, 
 	 .conv_param = {2, 2, 1, 1, 1, 1, 1, 1}, }, //unit conversion parameters
     {.name      = "mcp23009",
@@ -56,7 +76,9 @@ struct device hv_dev_list[4] = {
 	 .addr_low  = 0x20,
 	 .addr_high = 0x27,
 	 .read_val  = mcp23009_read_val2, 
-	 .print_val = mcp23009_print_val, },
+	 .title     = "------IO------",
+	 .nch       = 5,
+	 .bits      = 1, },
 	{.name = ""}
 };
  
@@ -79,11 +101,39 @@ static void help(void){
 "                  Bus number where HV is connected\n\n"
 "     -V (val)\n"
 "                  Vset value\n\n"
+"     -r (V/s)\n"
+"                  With -V: ramp Vset at V/s, reading VHVp/VHVn/IHVp/IHVn\n"
+"                  back between the steps\n\n"
+"     -L (uA)\n"
+"                  Ramp: pause above this current, abort above 1.5 times\n"
+"                  it or after 10 s paused\n\n"
 "     -I (val)\n"
-"                  Ilim value\n\n"
+"                  Ilim value, with -V both are staged and change at once\n\n"
 "     -l\n"
 "                  Write values to log file. The file can be found at\n"
 "                  i2c-system/log directory\n\n"
+"     -s (ch,ch,...)\n"
+"                  Stream ADC channels (e.g. IHVp,IHVn,VHVp) back to back\n"
+"                  until Ctrl-C, with -l to the binary log streamDATE.bin\n\n"
+"     -D (n)\n"
+"                  Stream: average n conversions per output sample\n\n"
+"     -t (sec)\n"
+"                  Stream, trip, watch: stop after sec seconds\n\n"
+"     -P\n"
+"                  Stream through the parent adapter, the mux channel\n"
+"                  selected once per transfer (needs idle_state -2)\n\n"
+"     -T (uA)\n"
+"                  Trip watcher: poll IHVp/IHVn and clear HVon when one\n"
+"                  goes over uA, then print the latency percentiles\n\n"
+"     -n\n"
+"                  Trip: dry run, read GPIO instead of clearing HVon\n"
+"                  and keep on watching (Ctrl-C or -t to stop)\n\n"
+"     -w\n"
+"                  Watch the inputs D0-D2, D4 and print their changes\n"
+"                  until Ctrl-C or -t, polled every 10 ms without -g\n\n"
+"     -g (chip:line)\n"
+"                  Watch: the MCP23009 INT line (e.g. gpiochip0:17),\n"
+"                  the inputs are read on its interrupts only\n\n"
 "     -on\n"
 "                  Turn the High-Voltage source on\n\n"
 "     -off\n"
@@ -94,26 +144,257 @@ static void help(void){
 }
 
 
-int get_addr(int fd, int addr_low, int addr_high){
-	int addri = -1;
-	for(addri=addr_low; addri<=addr_high; addri++){
-		if(ioctl(fd, I2C_SLAVE, addri) < 0) {
-			if (errno == EBUSY) {
+static struct i2c_cache cache;
+static volatile sig_atomic_t stop = 0;
+
+static void stop_handler(int sig){
+	stop = 1;
+}
+
+int get_addr(int fd, int adapter, const char *name, int addr_low, 
+															int addr_high){
+	int list[16];
+	int addr[8]; int busy[8];
+	int n; int i;
+
+	i2c_range_list(list, addr_low, addr_high);
+	n = i2c_cache_find(&cache, fd, adapter, name, list, addr, busy, 8);
+	for(i=0; i<n; i++){
+		if(!busy[i])
+			return addr[i];
+	}
+	return -1;
+}
+
+/*ADC channel mask of a "IHVp,IHVn,..." list, 0 on error*/
+unsigned stream_mask(const char *list){
+	struct device *dev = &hv_dev_list[0];
+	unsigned mask = 0;
+	size_t len;
+	int ch;
+
+	for(; *list; list+=len, list+=(*list == ',')){
+		len = strcspn(list, ",");
+		for(ch=0; ch<8; ch++){
+			if(strlen(dev->data_type[ch]) == len && 
+								!strncasecmp(dev->data_type[ch], list, len))
+				break;
+		}
+		if(ch == 8){
+			fprintf(stderr, "Error: no ADC channel %.*s\n", (int)len, list);
+			return 0;
+		}
+		mask |= 1u << ch;
+	}
+	return mask;
+}
+
+/*
+* Streams the channels of mask of the ADC to the binary log (log) or as
+* text to stdout, "time ch ch ..." in units, until Ctrl-C or sec seconds.
+*/
+int stream_adc(int fd, const struct i2c_mux *mux, int adapter, int addr, 
+						unsigned mask, int decim, double sec, int log){
+	static struct stream s;
+	static struct stream_frame frame[128];
+	static struct binlog_rec rec[128];
+	static struct logwr lw;
+	struct device *dev = &hv_dev_list[0];
+	struct stream_frame out;
+	struct timespec t0; struct timespec now;
+	float unit[8];
+	char *buf; char *p;
+	size_t room;
+	int n; int k; int ch; int rec_n; int err = 0;
+
+	conv_init(&dev->conv, dev->lsb, dev->conv_param, NULL, 0, 0);
+	if(log){
+		logwr_init(&lw, "stream", "bin", LOGWR_GROUP, LOGWR_FSYNC_NONE);
+		lw.rec_size = BINLOG_REC_SIZE;
+	}
+	else{
+		logwr_init_fd(&lw, STDOUT_FILENO, 1);
+		p = buf = logwr_reserve(&lw, &room);
+		p += sprintf(p, "time");
+		for(ch=0; ch<8; ch++){
+			if(mask & (1u << ch))
+				p += sprintf(p, " %s", dev->data_type[ch]);
+		}
+		*p++ = '\n';
+		logwr_advance(&lw, p - buf);
+		logwr_flush(&lw);
+	}
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	if(stream_start(&s, fd, mux, addr, mask, ads7828_queue_ch, decim) < 0){
+		logwr_close(&lw);
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	do{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(!stop && sec > 0 && (now.tv_sec - t0.tv_sec) + 
+								(now.tv_nsec - t0.tv_nsec)/1e9 >= sec)
+			stop = 1;
+		if((stop || s.failed) && !s.stop)
+			stream_stop(&s);		//then drain what is left
+		if((n = stream_drain(&s, frame, log ? 128 : 64)) == 0){
+			if(s.stop)
+				break;
+			usleep(10000);
+			continue;
+		}
+		if(logwr_line_start(&lw, frame[0].ts / 1000000000ULL) < 0){
+			err = 1;
+			if(!s.stop)
+				stream_stop(&s);	//joined before the ring goes away
+			break;
+		}
+		p = buf = logwr_reserve(&lw, &room);
+		for(k=0, rec_n=0; k<n; k++){
+			if(!stream_decimate(&s, &frame[k], &out))
 				continue;
-			} else {
-				fprintf(stderr, "Error: Could not set address to 0x%02x: %s\n",
-															addri,
-					 				                      	strerror(errno));
-				return EXIT_FAILURE;
+			if(log){
+				binlog_fill(&rec[rec_n++], BINLOG_ADS7828, 0, adapter, addr,
+														out.ts, out.val);
+				continue;
+			}
+			conv_snapshot(&dev->conv, out.val, unit);
+			p += sprintf(p, "%llu.%06llu", out.ts / 1000000000ULL, 
+								out.ts % 1000000000ULL / 1000);
+			for(ch=0; ch<8; ch++){
+				if(mask & (1u << ch)){
+					*p++ = ' ';
+					p = render_fixed(p, unit[ch]);
+				}
 			}
+			*p++ = '\n';
 		}
+		if(log)
+			logwr_append(&lw, rec, rec_n * sizeof(rec[0]));
+		else
+			logwr_advance(&lw, p - buf);
+		logwr_line_end(&lw);
+	}while(1);
 
-		if(i2c_smbus_write_quick(fd, I2C_SMBUS_WRITE) > -1)
-			break;
-	} 
-	return addri;
+	logwr_close(&lw);
+	stream_report(&s, adapter);
+	return s.failed || err ? -1 : 0;
 }
 
+/*Prints "time pin value" for the inputs that differ between from and to*/
+static unsigned long watch_print(__u64 ts, int from, int to){
+	struct device *dev = &hv_dev_list[2];
+	unsigned long n = 0;
+	int ch;
+
+	for(ch=0; ch<8; ch++){
+		if(!(HV_INPUTS & (from ^ to) & (1 << ch)))
+			continue;
+		printf("%llu.%06llu %.*s %d\n", ts / 1000000000ULL, 
+				ts % 1000000000ULL / 1000, 
+				(int)strcspn(dev->data_type[ch], " "), dev->data_type[ch], 
+				!!(to & (1 << ch)));
+		n++;
+	}
+	fflush(stdout);
+	return n;
+}
+
+/*
+* Watches the inputs of the MCP23009 at addr until Ctrl-C or sec seconds.
+* With the INT line (spec) the bus is only used when it fires: INTCAP
+* gives the inputs at the interrupt, dated by the edge, GPIO what changed
+* since. Without it, or if it can't be set up, GPIO is polled.
+*/
+int watch_inputs(int fd, int addr, const char *spec, double sec){
+	static struct i2c_batch b;
+	struct gpio_line l;
+	struct mcp23009 *m;
+	__u16 r[8];
+	__u64 ts; __u64 end = 0;
+	int state = -1; int evt = 0; int ret; int held = 0;
+	unsigned long changes = 0; unsigned long reads = 0;
+	unsigned long interrupts = 0;
+
+	if((m = mcp23009_hv(fd, addr)) == NULL){
+		fprintf(stderr, "Error: can't set the inputs up; %s\n", 
+															strerror(errno));
+		return -1;
+	}
+	if(spec && gpio_line_open(&l, spec, "hv") == 0){
+		if((state = mcp23009_int_enable(m, HV_INPUTS)) >= 0)
+			evt = 1;
+		else
+			gpio_line_close(&l);
+	}
+	if(!evt){
+		if(spec)
+			fprintf(stderr, "watch: polling every %d ms\n", WATCH_POLL_MS);
+		state = mcp23009_read_val(fd, addr, MCP23009_REG_GPIO);
+	}
+	if(state < 0 || i2c_batch_init(&b, fd) < 0){
+		fprintf(stderr, "Error: can't read the inputs; %s\n", strerror(errno));
+		return -1;
+	}
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+	if(sec > 0)
+		end = binlog_now() + sec * 1e9;
+	printf("time pin value\n");
+	watch_print(binlog_now(), ~state, state);
+
+	while(!stop && !(end && binlog_now() >= end)){
+		if(!evt){
+			usleep(WATCH_POLL_MS * 1000);
+			if((ret = mcp23009_read_val(fd, addr, MCP23009_REG_GPIO)) < 0)
+				break;
+			reads++;
+			changes += watch_print(binlog_now(), state, ret);
+			state = ret;
+			continue;
+		}
+		//INT still low (a change came in while it was read, or another
+		//chip on the line): no new edge will come, read it again, at
+		//the poll rate if it stays low
+		if(gpio_line_get(&l) == 0){
+			if(held++)
+				usleep(WATCH_POLL_MS * 1000);
+			ts = binlog_now();
+		}
+		else{
+			held = 0;
+			if((ret = gpio_line_wait(&l, 100, &ts)) < 0){
+				fprintf(stderr, "Error: INT line; %s\n", strerror(errno));
+				break;
+			}
+			if(ret == 0)
+				continue;
+			interrupts++;
+		}
+		if(mcp23009_queue_int(&b, addr, r) < 0 || i2c_batch_flush(&b) < 0)
+			break;
+		reads++;
+		if(r[0]){				//INTF: INTCAP is this interrupt's
+			changes += watch_print(ts, state, r[1]);
+			state = r[1];
+		}
+		ts = binlog_now();
+		changes += watch_print(ts, state, r[2]);
+		state = r[2];
+	}
+
+	if(evt){
+		mcp23009_int_disable(m);
+		gpio_line_close(&l);
+		fprintf(stderr, "watch: %lu changes, %lu interrupts (%lu edges), "
+				"%lu bus reads\n", changes, interrupts, l.edges, reads);
+	}
+	else
+		fprintf(stderr, "watch: %lu changes, %lu bus reads\n", changes, reads);
+	return 0;
+}
 
 int main(int argc, char *argv[]){
 
@@ -124,6 +405,10 @@ int main(int argc, char *argv[]){
 	//int version = 0; 
 	int hlp = 0; 
 	int flags = 0; int log = 0;
+	unsigned stream = 0; int decim = 1; double sec = 0; int direct = 0;
+	float rate = 0; float limit = 0;
+	float trip_ua = 0; int dry = 0;
+	int watch = 0; const char *int_line = NULL;
 	while (1+flags < argc && argv[1+flags][0] == '-') {
 	    switch (argv[1+flags][1]) {
 			//case 'h': hlp = 1; break;
@@ -145,6 +430,67 @@ int main(int argc, char *argv[]){
 			case 'l': 
 					log = 1; 					
 					break;
+			case 's':
+					flags++;
+					if(1+flags >= argc || 
+								(stream = stream_mask(argv[1+flags])) == 0){
+						help();
+						return EXIT_FAILURE;
+					}
+					break;
+			case 'P':
+					direct = 1;
+					break;
+			case 'r':
+					flags++;
+					if(1+flags >= argc || (rate = atof(argv[1+flags])) <= 0){
+						help();
+						return EXIT_FAILURE;
+					}
+					break;
+			case 'T':
+					flags++;
+					if(1+flags >= argc || 
+								(trip_ua = atof(argv[1+flags])) <= 0){
+						help();
+						return EXIT_FAILURE;
+					}
+					break;
+			case 'n':
+					dry = 1;
+					break;
+			case 'w':
+					watch = 1;
+					break;
+			case 'g':
+					flags++;
+					if(1+flags >= argc){
+						help();
+						return EXIT_FAILURE;
+					}
+					int_line = argv[1+flags];
+					break;
+			case 'L':
+					flags++;
+					if(1+flags >= argc || (limit = atof(argv[1+flags])) <= 0){
+						help();
+						return EXIT_FAILURE;
+					}
+					break;
+			case 'D':
+					flags++;
+					if(1+flags >= argc || (decim = atoi(argv[1+flags])) < 1){
+						help();
+						return EXIT_FAILURE;
+					}
+					break;
+			case 't':
+					flags++;
+					if(1+flags >= argc || (sec = atof(argv[1+flags])) <= 0){
+						help();
+						return EXIT_FAILURE;
+					}
+					break;
 			case 'h': 
 					hlp = 1; 					
 					break;
@@ -178,38 +524,154 @@ int main(int argc, char *argv[]){
 		return EXIT_FAILURE;
 	}
 
-	char filename[20];
 	int fd;
 	//char str[20];
-   	snprintf(filename, 19, "/dev/i2c-%d", bus+BUS_OFFSET);
-   	
-	if((fd = open(filename, O_RDWR)) < 0){
+	if((fd = i2c_bus_open(bus+BUS_OFFSET)) < 0){
 		printf("Failed to open the bus (adapter); %s\n", strerror(errno));
 		
 		return EXIT_FAILURE;
 	}
+	int adapter = bus+BUS_OFFSET;
 	int addr = 0;
-	if(flag_vset){
-		addr = get_addr(fd, AD5694_ADDR_LOW, AD5694_ADDR_HIGH);
+	i2c_cache_load(&cache, I2C_CACHE_FILE);
+	if(stream){
+		addr = get_addr(fd, adapter, "ads7828", hv_dev_list[0].addr_low, 
+												hv_dev_list[0].addr_high);
+		i2c_cache_save(&cache, I2C_CACHE_FILE);
+		if(addr < 0){
+			fprintf(stderr, "Error: no ADC on i2c-%d\n", adapter);
+			return EXIT_FAILURE;
+		}
+		struct i2c_mux mux;
+		int sfd = fd;
+		if(direct){
+			if(i2c_mux_find(adapter, &mux) < 0){
+				fprintf(stderr, "Error: i2c-%d is not a mux channel\n", 
+																	adapter);
+				return EXIT_FAILURE;
+			}
+			if(i2c_mux_check(&mux) < 0 || 
+								(sfd = i2c_bus_open(mux.parent)) < 0)
+				return EXIT_FAILURE;
+		}
+		int ret = stream_adc(sfd, direct ? &mux : NULL, adapter, addr, 
+											stream, decim, sec, log);
+		if(sfd != fd)
+			i2c_bus_close(sfd);
+		i2c_bus_close(fd);
+		return ret < 0 ? EXIT_FAILURE : 0;
+	}
+	if(watch){
+		addr = get_addr(fd, adapter, "mcp23009", MCP23009_ADDR_LOW, 
+														MCP23009_ADDR_HIGH);
+		i2c_cache_save(&cache, I2C_CACHE_FILE);
+		if(addr < 0){
+			fprintf(stderr, "Error: no GPIO on i2c-%d\n", adapter);
+			return EXIT_FAILURE;
+		}
+		int ret = watch_inputs(fd, addr, int_line, sec);
+		i2c_bus_close(fd);
+		return ret < 0 ? EXIT_FAILURE : 0;
+	}
+	if(trip_ua > 0){
+		static struct trip t;
+		float code = trip_ua / (hv_dev_list[0].lsb * 
+										hv_dev_list[0].conv_param[0]);
+		__u16 th = (__u16)code;
+		int adc; int gpio;
+		if(code >= 4095){
+			fprintf(stderr, "Error: -T %0.3f uA is at or above the ADC full "
+					"scale (%0.3f uA), it could never trip\n", trip_ua, 
+					4095 * hv_dev_list[0].lsb * hv_dev_list[0].conv_param[0]);
+			return EXIT_FAILURE;
+		}
+		adc = get_addr(fd, adapter, "ads7828", hv_dev_list[0].addr_low, 
+												hv_dev_list[0].addr_high);
+		gpio = get_addr(fd, adapter, "mcp23009", MCP23009_ADDR_LOW, 
+														MCP23009_ADDR_HIGH);
+		i2c_cache_save(&cache, I2C_CACHE_FILE);
+		if(adc < 0 || gpio < 0){
+			fprintf(stderr, "Error: no ADC or GPIO on i2c-%d\n", adapter);
+			return EXIT_FAILURE;
+		}
+		if(trip_init(&t, fd, adc, gpio, th, th, dry) < 0)
+			return EXIT_FAILURE;
+		t.cancel = &stop;
+		signal(SIGINT, stop_handler);
+		signal(SIGTERM, stop_handler);
+		fprintf(stderr, "trip: watching IHVp/IHVn over %0.3f uA (code %u)\n",
+															trip_ua, th);
+		int ret = trip_run(&t, sec);
+		trip_report(&t);
+		i2c_bus_close(fd);
+		return ret < 0 ? EXIT_FAILURE : 0;
+	}
+	if(flag_vset && rate > 0){
+		static struct ramp r;
+		int adc;
+		addr = get_addr(fd, adapter, "ad5694", AD5694_ADDR_LOW, 
+														AD5694_ADDR_HIGH);
+		adc = get_addr(fd, adapter, "ads7828", hv_dev_list[0].addr_low, 
+												hv_dev_list[0].addr_high);
+		i2c_cache_save(&cache, I2C_CACHE_FILE);
+		if(addr < 0 || adc < 0){
+			fprintf(stderr, "Error: no DAC or ADC on i2c-%d\n", adapter);
+			return EXIT_FAILURE;
+		}
+		if(ramp_init(&r, fd, addr, 0, adc) < 0)
+			return EXIT_FAILURE;
+		//the limit first: the ramp is then guarded by it all the way
+		if(flag_ilim && ad5694_write_ch(fd, addr, 1, 
+											vset_ilim_to_ad5694(ilim)) != 0){
+			fprintf(stderr, "Error: can't set Ilim; %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		r.kv_code = 2*LSB;
+		r.adc_kv_code = hv_dev_list[0].lsb * hv_dev_list[0].conv_param[3];
+		r.adc_ua_code = hv_dev_list[0].lsb * hv_dev_list[0].conv_param[0];
+		r.rate = rate;
+		r.limit = limit;
+		r.cancel = &stop;
+		signal(SIGINT, stop_handler);
+		signal(SIGTERM, stop_handler);
+		int ret = ramp_run(&r, vset_ilim_to_ad5694(vset));
+		ramp_report(&r);
+		i2c_bus_close(fd);
+		return ret < 0 ? EXIT_FAILURE : 0;
+	}
+	else if(flag_vset && flag_ilim){	//staged, both outputs move together
+		static struct i2c_batch b;
+		__u16 code[4] = {vset_ilim_to_ad5694(vset), 
+										vset_ilim_to_ad5694(ilim), 0, 0};
+		addr = get_addr(fd, adapter, "ad5694", AD5694_ADDR_LOW, 
+														AD5694_ADDR_HIGH);
+		if(addr < 0 || i2c_batch_init(&b, fd) < 0 || 
+						ad5694_queue_setpoint(&b, addr, 0x03, code) < 0 || 
+												i2c_batch_flush(&b) < 0)
+			fprintf(stderr, "Error: can't set Vset and Ilim; %s\n", 
+															strerror(errno));
+	}
+	else if(flag_vset){
+		addr = get_addr(fd, adapter, "ad5694", AD5694_ADDR_LOW, 
+														AD5694_ADDR_HIGH);
 		ad5694_write_ch(fd, addr, 0, vset_ilim_to_ad5694(vset));
 	}
 
-	if(flag_ilim){
-		addr = get_addr(fd, AD5694_ADDR_LOW, AD5694_ADDR_HIGH);
+	if(flag_ilim && !flag_vset){
+		addr = get_addr(fd, adapter, "ad5694", AD5694_ADDR_LOW, 
+														AD5694_ADDR_HIGH);
 		ad5694_write_ch(fd, addr, 1, vset_ilim_to_ad5694(ilim));
 	}
 
-	if(hv_on){
-		addr = get_addr(fd, MCP23009_ADDR_LOW, MCP23009_ADDR_HIGH);
-		mcp23009_write_val(fd, addr, MCP23009_REG_GPPU, 0x08);
-		mcp23009_write_val(fd, addr, MCP23009_REG_IODIR, 0x17);
-		mcp23009_write_val(fd, addr, MCP23009_REG_GPIO, 0x08);
-	}
-	else if(hv_off){
-		addr = get_addr(fd, MCP23009_ADDR_LOW, MCP23009_ADDR_HIGH);
-		mcp23009_write_val(fd, addr, MCP23009_REG_GPPU, 0x08);
-		mcp23009_write_val(fd, addr, MCP23009_REG_IODIR, 0x17);
-		mcp23009_write_val(fd, addr, MCP23009_REG_GPIO, 0x00);
+	if(hv_on || hv_off){	//HVon only, the other outputs as they are
+		struct mcp23009 *m = NULL;
+		addr = get_addr(fd, adapter, "mcp23009", MCP23009_ADDR_LOW, 
+														MCP23009_ADDR_HIGH);
+		if(addr < 0 || (m = mcp23009_hv(fd, addr)) == NULL || 
+						(hv_on ? mcp23009_set(m, MCP23009_HV_ON) :
+								 mcp23009_clear(m, MCP23009_HV_ON)) < 0)
+			fprintf(stderr, "Error: can't switch the HV %s; %s\n", 
+								hv_on ? "on" : "off", strerror(errno));
 	}
 	
 	if(!(flag_vset || flag_ilim || hv_on || hv_off)){ //Read all devices
@@ -218,83 +680,63 @@ int main(int argc, char *argv[]){
 
 		subsystem.bus_num = bus;
 		subsystem.device_list = hv_dev_list;
-		int n; int logfile = 0;
-		if(log){
-			time_t rawtime;
-		  	struct tm *info;
-			char date[20];
-			char hour[32];
-			char file_path [64] = "/home/hv/i2c-system/log/";
-		   	time( &rawtime );
-			info = localtime( &rawtime );
-
-
-			sprintf(date, "hv%04d-%02d-%02d.log", info->tm_year+1900,
-	   											  info->tm_mon+1,
-	   											  info->tm_mday);
-
-		   	strcat(file_path, date);								
-		   	logfile = open(file_path, O_WRONLY|O_APPEND|O_CREAT);
-		   	fchmod(logfile, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-		   		
-	   	sprintf(hour, "%04d-%02d-%02dT%02d:%02d:%02d; ", info->tm_year+1900, 
-	   													info->tm_mon+1,
-	   												   	info->tm_mday,
-	   												   	info->tm_hour, 
-	   									   				info->tm_min, 
-	   									   				info->tm_sec);
-	
-			write(logfile, hour, 21);
-		}
+		int n; int it_n = 0;
+		static struct logwr logw;
+		static __u16 val[3*8][8];
+		static float unit[3*8][8];
+		static struct render_item it[3*8];
+		struct timespec ts;
 
+		clock_gettime(CLOCK_REALTIME, &ts);
 		for(n=0; subsystem.device_list[n].name[0]!='\0'; n++){
-			int addri; int i=0;
-			int low = subsystem.device_list[n].addr_low;
-			int high = subsystem.device_list[n].addr_high; 
-			for(addri=low; addri<=high; addri++){
-				if(ioctl(fd, I2C_SLAVE, addri) < 0) {
-				    if (errno == EBUSY){
-			        	if(log){
-							char str[20];
-							sprintf(str, "0 ");
-							write(logfile, str, strlen(str));
-						}
-						else{
-						printf("%s%d: 0\n", 
-										subsystem.device_list[n].data_type[0], 
-										i);
-						i++;
-						}
-						continue;
-			        } else {
-			            fprintf(stderr, "Error: Could not set "
-	 			                                 	"address to 0x%02x: %s\n", 
-													addri,
-			     				                 	strerror(errno));
-			            return EXIT_FAILURE;
-			        }
+			struct device *dev = &subsystem.device_list[n];
+			int k;
+			int list[16];
+			int addr_l[8]; int busy[8]; int found;
+			i2c_range_list(list, dev->addr_low, dev->addr_high);
+			found = i2c_cache_find(&cache, fd, adapter, dev->name, list, 
+															addr_l, busy, 8);
+			if(found < 0)
+				return EXIT_FAILURE;
+			conv_init(&dev->conv, dev->lsb, dev->conv_param, NULL, 0, 0);
+			for(k=0; k<found; k++, it_n++){
+				if(!busy[k]){
+					dev->read_val(fd, addr_l[k], val[it_n]);
+					conv_snapshot(&dev->conv, val[it_n], unit[it_n]);
 				}
-
-				if( i2c_smbus_write_quick(fd, I2C_SMBUS_WRITE) < 0)
-					continue;
-
-				subsystem.device_list[n].read_val(fd, addri, 
-										   subsystem.device_list[n].val);
-	
-				subsystem.device_list[n].print_val(
-										 	subsystem.device_list[n].val, 
-										 	subsystem.device_list[n].lsb,
-										 	subsystem.device_list[n].conv_param,
-										 	subsystem.device_list[n].data_type,
-										 	i, log, logfile);
-				i++;	
+				it[it_n].dev = dev->name;
+				it[it_n].title = dev->title;
+				it[it_n].data_type = dev->data_type;
+				it[it_n].unit_name = dev->unit_name;
+				it[it_n].nch = dev->nch;
+				it[it_n].bits = dev->bits;
+				it[it_n].adapter = adapter;
+				it[it_n].inst = k;
+				it[it_n].busy = busy[k];
+				it[it_n].val = val[it_n];
+				it[it_n].unit = unit[it_n];
 			}
 		}
-		close(fd);
-		if(log){
-			write(logfile, "\n", 1);
-			close(logfile);
-		}
+		i2c_bus_close(fd);
+
+		if(log)
+			logwr_init(&logw, "hv", "log", 1, LOGWR_FSYNC_NONE);
+		else
+			logwr_init_fd(&logw, STDOUT_FILENO, 1);
+		if(logwr_line_start(&logw, ts.tv_sec) < 0)
+			return EXIT_FAILURE;
+		size_t room;
+		char *buf;
+		int done = 0;
+		fflush(stdout);
+		do{
+			buf = logwr_reserve(&logw, &room);
+			logwr_advance(&logw, render_cycle(log ? RENDER_LOG : RENDER_TEXT,
+										&ts, it, it_n, &done, buf, room));
+		}while(done < it_n && logwr_flush_partial(&logw) == 0);
+		logwr_line_end(&logw);
+		logwr_close(&logw);
 	}
+	i2c_cache_save(&cache, I2C_CACHE_FILE);
 	return 0;
 }
@@ -0,0 +1,625 @@
+/*
+*	i2c_bus.c -	Bus level helpers shared by tool, hv and prec:
+*				adapter handles, device probing, the persistent 
+*				discovery cache and I2C_RDWR transfer batches.
+*
+*	The handle layer remembers the slave address each adapter fd points 
+*	to, so the drivers can call i2c_set_slave() before every transfer and
+*	only the first access to a new address costs an I2C_SLAVE ioctl. The 
+*	busses must be opened and closed with i2c_bus_open()/i2c_bus_close() 
+*	so a reused fd never inherits a stale address. The adapter
+*	functionality is queried once per fd the same way, and each fd keeps
+*	a batch for the one-shot reads (i2c_bus_batch()).
+*
+*	The cache keeps the (adapter, address, driver) topology found by the
+*	last full scan. A later run checks each cached device with a single
+*	quick write and only rescans the whole address range of a driver when 
+*	that check fails, so the start up traffic is one transaction per 
+*	device present instead of one per possible address.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <linux/swab.h>
+#include "i2c_bus.h"
+
+static int i2c_fd_slave[I2C_FD_MAX];	//slave address + 1, 0 when unknown
+static int i2c_fd_adapter[I2C_FD_MAX];	//adapter number + 1
+static unsigned long i2c_fd_funcs[I2C_FD_MAX];
+static char i2c_fd_funcs_ok[I2C_FD_MAX];	//i2c_fd_funcs[] queried
+static struct i2c_batch *i2c_fd_batch[I2C_FD_MAX];
+
+static void i2c_fd_reset(int fd){
+	i2c_fd_slave[fd] = 0;
+	i2c_fd_funcs_ok[fd] = 0;
+	free(i2c_fd_batch[fd]);
+	i2c_fd_batch[fd] = NULL;
+}
+
+int i2c_bus_open(int adapter){
+	char filename[20];
+	int fd;
+
+   	snprintf(filename, 19, "/dev/i2c-%d", adapter);
+	if((fd = open(filename, O_RDWR)) < 0)
+		return -1;
+	if(fd < I2C_FD_MAX){
+		i2c_fd_reset(fd);
+		i2c_fd_adapter[fd] = adapter+1;
+	}
+	return fd;
+}
+
+int i2c_bus_close(int fd){
+	if(fd >= 0 && fd < I2C_FD_MAX){
+		i2c_fd_reset(fd);
+		i2c_fd_adapter[fd] = 0;
+	}
+	return close(fd);
+}
+
+/*Adapter number the fd was opened on, -1 if unknown*/
+int i2c_bus_adapter(int fd){
+	if(fd < 0 || fd >= I2C_FD_MAX)
+		return -1;
+	return i2c_fd_adapter[fd]-1;
+}
+
+/*I2C_FUNCS of the fd, the ioctl only on the first call*/
+int i2c_bus_funcs(int fd, unsigned long *funcs){
+	if(fd >= 0 && fd < I2C_FD_MAX && i2c_fd_funcs_ok[fd]){
+		*funcs = i2c_fd_funcs[fd];
+		return 0;
+	}
+	if(ioctl(fd, I2C_FUNCS, funcs) < 0)
+		return -1;
+	if(fd >= 0 && fd < I2C_FD_MAX){
+		i2c_fd_funcs[fd] = *funcs;
+		i2c_fd_funcs_ok[fd] = 1;
+	}
+	return 0;
+}
+
+int i2c_set_slave(int fd, int addr){
+	if(fd >= 0 && fd < I2C_FD_MAX && i2c_fd_slave[fd] == addr+1)
+		return 0;
+	if(ioctl(fd, I2C_SLAVE, addr) < 0)
+		return -1;			//errno kept for the caller, EBUSY on probes
+	if(fd >= 0 && fd < I2C_FD_MAX)
+		i2c_fd_slave[fd] = addr+1;
+	return 0;
+}
+
+/*
+*	Physical controller of an adapter: the first i2c-N in its sysfs path,
+*	e.g. .../i2c-1/1-0070/i2c-9 for a PCA9547 channel. An adapter that 
+*	isn't a mux channel (or without sysfs) is its own parent.
+*/
+int i2c_bus_parent(int adapter){
+	char path[64];
+	char real[PATH_MAX];
+	char *p;
+	int parent;
+
+	snprintf(path, sizeof(path), "/sys/bus/i2c/devices/i2c-%d", adapter);
+	if(realpath(path, real) == NULL)
+		return adapter;
+	for(p=real; (p = strstr(p, "/i2c-")) != NULL; p++){
+		if(sscanf(p, "/i2c-%d", &parent) == 1)
+			return parent;
+	}
+	return adapter;
+}
+
+/*
+*	The mux of a child adapter, from sysfs: .../i2c-1/1-0070/i2c-9 is behind
+*	the mux at 0x70 of i2c-1, and 1-0070/channel-K links to it. Returns -1 
+*	if the adapter isn't a mux channel.
+*/
+int i2c_mux_find(int adapter, struct i2c_mux *mux){
+	char path[PATH_MAX + 256];
+	char real[PATH_MAX];
+	char link[PATH_MAX];
+	char *p;
+	DIR *dir;
+	struct dirent *e;
+
+	snprintf(path, sizeof(path), "/sys/bus/i2c/devices/i2c-%d", adapter);
+	if(realpath(path, real) == NULL || (p = strrchr(real, '/')) == NULL)
+		return -1;
+	*p = '\0';
+	if((p = strrchr(real, '/')) == NULL || 
+				sscanf(p, "/%d-%x", &mux->parent, &mux->addr) != 2)
+		return -1;
+	mux->chan = -1;
+	if((dir = opendir(real)) == NULL)
+		return -1;
+	while((e = readdir(dir)) != NULL){
+		int chan; int child;
+		if(sscanf(e->d_name, "channel-%d", &chan) != 1)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", real, e->d_name);
+		if(realpath(path, link) != NULL && (p = strrchr(link, '/')) && 
+				sscanf(p, "/i2c-%d", &child) == 1 && child == adapter)
+			mux->chan = chan;
+	}
+	closedir(dir);
+	return mux->chan < 0 ? -1 : 0;
+}
+
+/*
+*	Direct access to a mux channel from the parent adapter is only safe 
+*	when the kernel mux driver, if bound, deselects its channels when 
+*	idle: it then selects the channel again for every transfer of its own
+*	and doesn't rely on the one it left. Our transfers are single 
+*	I2C_RDWR calls, select + ops + deselect, done under the parent adapter
+*	lock the mux driver takes too, so they never interleave with its own.
+*/
+int i2c_mux_check(struct i2c_mux *mux){
+	char path[96];
+	char buf[16];
+	int fd; int len; int idle;
+
+	snprintf(path, sizeof(path), "/sys/bus/i2c/devices/%d-%04x/driver", 
+													mux->parent, mux->addr);
+	if(access(path, F_OK) < 0)
+		return 0;				//no kernel driver on the mux
+	snprintf(path, sizeof(path), "/sys/bus/i2c/devices/%d-%04x/idle_state",
+													mux->parent, mux->addr);
+	if((fd = open(path, O_RDONLY)) < 0){
+		fprintf(stderr, "Error: can't read %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+	len = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	buf[len > 0 ? len : 0] = '\0';
+	if(sscanf(buf, "%d", &idle) != 1 || idle != I2C_MUX_IDLE_DISCONNECT){
+		fprintf(stderr, "Error: direct mux access needs the mux to deselect "
+				"when idle: echo %d > %s\n", I2C_MUX_IDLE_DISCONNECT, path);
+		return -1;
+	}
+	return 0;
+}
+
+/*SCL frequency of a physical adapter from the device tree, Hz*/
+int i2c_bus_clock(int adapter){
+	char path[80];
+	unsigned char be[4];
+	int fd; int hz = I2C_BUS_HZ_DEFAULT;
+
+	snprintf(path, sizeof(path), 
+				"/sys/bus/i2c/devices/i2c-%d/of_node/clock-frequency", adapter);
+	if((fd = open(path, O_RDONLY)) < 0)
+		return hz;
+	if(read(fd, be, 4) == 4)	//a big-endian u32 cell
+		hz = be[0]<<24 | be[1]<<16 | be[2]<<8 | be[3];
+	close(fd);
+	return hz;
+}
+
+/*Probe one address: set slave + quick write*/
+int i2c_probe(int fd, int addr){
+	if(i2c_set_slave(fd, addr) < 0) {
+		if (errno == EBUSY)
+			return I2C_PROBE_BUSY;
+		fprintf(stderr, "Error: Could not set address to 0x%02x: %s\n",
+														addr, strerror(errno));
+		return -1;
+	}
+
+	if(i2c_smbus_write_quick(fd, I2C_SMBUS_WRITE) < 0)
+		return I2C_PROBE_ABSENT;
+
+	return I2C_PROBE_PRESENT;
+}
+
+/*Fill list[] with low..high, 0 terminated (list needs high-low+2 slots)*/
+int i2c_range_list(int list[], int low, int high){
+	int n = 0;
+	for(; low<=high; low++)
+		list[n++] = low;
+	list[n] = 0;
+	return n;
+}
+
+int i2c_cache_load(struct i2c_cache *c, const char *path){
+	FILE *fp;
+	char line[64];
+	char addr[8]; char state[16];
+	struct i2c_cache_entry *e;
+
+	c->n = 0;
+	c->dirty = 0;
+	if((fp = fopen(path, "r")) == NULL)
+		return 0;				//no cache yet, everything gets scanned
+
+	while(fgets(line, sizeof(line), fp) != NULL && c->n < I2C_CACHE_N_MAX){
+		if(line[0] == '#')
+			continue;
+		e = &c->entry[c->n];
+		state[0] = '\0';
+		if(sscanf(line, "%d %7s %19s %15s", &e->adapter, addr, e->name, 
+																	state) < 3)
+			continue;
+		if(!strcmp(addr, "none")){
+			e->addr = -1;
+			e->state = I2C_PROBE_ABSENT;
+		}
+		else{
+			e->addr = strtol(addr, NULL, 0);
+			e->state = strcmp(state, "busy") ? I2C_PROBE_PRESENT : 
+															I2C_PROBE_BUSY;
+		}
+		c->n++;
+	}
+	fclose(fp);
+	return c->n;
+}
+
+int i2c_cache_save(struct i2c_cache *c, const char *path){
+	FILE *fp;
+	char tmp_path[128];
+	int i;
+	struct i2c_cache_entry *e;
+
+	if(!c->dirty)
+		return 0;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	if((fp = fopen(tmp_path, "w")) == NULL){
+		fprintf(stderr, "Error: can't write %s; %s\n", tmp_path, 
+															strerror(errno));
+		return -1;
+	}
+	fprintf(fp, "#adapter address device state\n");
+	for(i=0; i<c->n; i++){
+		e = &c->entry[i];
+		if(e->addr < 0)
+			fprintf(fp, "%d none %s\n", e->adapter, e->name);
+		else
+			fprintf(fp, "%d 0x%02x %s %s\n", e->adapter, e->addr, e->name, 
+							e->state == I2C_PROBE_BUSY ? "busy" : "present");
+	}
+	fclose(fp);
+
+	if(rename(tmp_path, path) < 0){
+		fprintf(stderr, "Error: can't write %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+	c->dirty = 0;
+	return 0;
+}
+
+void i2c_cache_forget(struct i2c_cache *c, int adapter, const char *name){
+	int i; int j = 0;
+	for(i=0; i<c->n; i++){
+		if(c->entry[i].adapter == adapter && 
+							(name == NULL || !strcmp(c->entry[i].name, name)))
+			continue;
+		c->entry[j++] = c->entry[i];
+	}
+	if(j != c->n)
+		c->dirty = 1;
+	c->n = j;
+}
+
+static void i2c_cache_add(struct i2c_cache *c, int adapter, int addr, 
+												const char *name, int state){
+	struct i2c_cache_entry *e;
+	if(c->n >= I2C_CACHE_N_MAX)
+		return;					//not cached, scanned again next run
+	e = &c->entry[c->n++];
+	e->adapter = adapter;
+	e->addr = addr;
+	e->state = state;
+	strncpy(e->name, name, sizeof(e->name)-1);
+	e->name[sizeof(e->name)-1] = '\0';
+	c->dirty = 1;
+}
+
+/*
+*	Addresses of driver `name` on `adapter`, in ascending order. The cached
+*	addresses are verified with one probe each; list (0 terminated) is only 
+*	scanned when the driver is not cached or a verification fails. 
+*	Returns the number of addresses or -1 on error.
+*/
+int i2c_cache_find(struct i2c_cache *c, int fd, int adapter, const char *name, 
+							const int *list, int addr[], int busy[], int n_max){
+	int i; int p; int n = 0; int known = 0;
+	struct i2c_cache_entry *e;
+
+	for(i=0; i<c->n; i++){
+		e = &c->entry[i];
+		if(e->adapter != adapter || strcmp(e->name, name))
+			continue;
+		known = 1;
+		if(e->addr < 0)
+			continue;
+		if((p = i2c_probe(fd, e->addr)) < 0)
+			return -1;
+		if(p != e->state || n >= n_max){
+			known = 0;			//topology changed, rescan
+			break;
+		}
+		addr[n] = e->addr;
+		busy[n] = (p == I2C_PROBE_BUSY);
+		n++;
+	}
+	if(known)
+		return n;
+
+	n = 0;
+	i2c_cache_forget(c, adapter, name);
+	for(i=0; list[i]!=0; i++){
+		if((p = i2c_probe(fd, list[i])) < 0)
+			return -1;
+		if(p == I2C_PROBE_ABSENT)
+			continue;
+		if(n >= n_max){
+			fprintf(stderr, "Error: too many %s on adapter %d\n", name, 
+																	adapter);
+			return -1;
+		}
+		addr[n] = list[i];
+		busy[n] = (p == I2C_PROBE_BUSY);
+		n++;
+		i2c_cache_add(c, adapter, list[i], name, p);
+	}
+	if(n == 0)
+		i2c_cache_add(c, adapter, -1, name, I2C_PROBE_ABSENT);
+	c->dirty = 1;
+	return n;
+}
+
+/*
+*
+*	BATCH
+*
+*/
+int i2c_batch_init(struct i2c_batch *b, int fd){
+	b->fd = fd;
+	b->n = 0;
+	b->mux_addr = 0;
+	b->mux_writes = 0;
+	if(i2c_bus_funcs(fd, &b->funcs) < 0) {
+		fprintf(stderr, "Error: Could not get the adapter functionality matrix: %s\n", 
+															strerror(errno));
+		b->funcs = 0;
+		return -1;
+  	}
+	return 0;
+}
+
+/*
+*	The batch kept for fd, empty, for the reads done in one call (the
+*	*_read_all() of the drivers): nothing to build on the stack nor to
+*	query per read. NULL above I2C_FD_MAX or out of memory.
+*/
+struct i2c_batch *i2c_bus_batch(int fd){
+	struct i2c_batch *b;
+
+	if(fd < 0 || fd >= I2C_FD_MAX)
+		return NULL;
+	if((b = i2c_fd_batch[fd]) == NULL){
+		if((b = malloc(sizeof(*b))) == NULL)
+			return NULL;
+		if(i2c_batch_init(b, fd) < 0){
+			free(b);
+			return NULL;
+		}
+		i2c_fd_batch[fd] = b;
+	}
+	b->n = 0;
+	return b;
+}
+
+/*Flushes through the parent adapter (b->fd), the channel of mux selected 
+  around every I2C_RDWR*/
+int i2c_batch_mux(struct i2c_batch *b, const struct i2c_mux *mux){
+	if(!(b->funcs & I2C_FUNC_I2C)){
+		fprintf(stderr, "Error: i2c-%d can't do I2C_RDWR transfers\n", 
+																mux->parent);
+		return -1;
+	}
+	b->mux_addr = mux->addr;
+	b->mux_sel = I2C_MUX_SELECT | mux->chan;
+	b->mux_desel = 0;
+	b->msg[0].addr = mux->addr;
+	b->msg[0].flags = 0;
+	b->msg[0].buf = &b->mux_sel;
+	b->msg[0].len = 1;
+	return 0;
+}
+
+static struct i2c_batch_op *i2c_batch_add(struct i2c_batch *b, int type, 
+															int addr, __u8 cmd){
+	struct i2c_batch_op *op;
+	if(b->n >= I2C_BATCH_OP_MAX){
+		fprintf(stderr, "Error: i2c batch full\n");
+		return NULL;
+	}
+	op = &b->op[b->n++];
+	op->type = type;
+	op->addr = addr;
+	op->buf[0] = cmd;
+	op->dst = NULL;
+	op->shift = 0;
+	return op;
+}
+
+int i2c_batch_write_byte_data(struct i2c_batch *b, int addr, __u8 reg, 
+																__u8 val){
+	struct i2c_batch_op *op;
+	if((op = i2c_batch_add(b, I2C_BATCH_WRITE_BYTE_DATA, addr, reg)) == NULL)
+		return -1;
+	op->buf[1] = val;
+	return 0;
+}
+
+int i2c_batch_read_byte_data(struct i2c_batch *b, int addr, __u8 reg, 
+																__u16 *dst){
+	struct i2c_batch_op *op;
+	if((op = i2c_batch_add(b, I2C_BATCH_READ_BYTE_DATA, addr, reg)) == NULL)
+		return -1;
+	op->dst = dst;
+	return 0;
+}
+
+int i2c_batch_read_word(struct i2c_batch *b, int addr, __u8 cmd, __u16 *dst,
+																	int shift){
+	struct i2c_batch_op *op;
+	if((op = i2c_batch_add(b, I2C_BATCH_READ_WORD, addr, cmd)) == NULL)
+		return -1;
+	op->dst = dst;
+	op->shift = shift;
+	return 0;
+}
+
+int i2c_batch_write_byte(struct i2c_batch *b, int addr, __u8 val){
+	return i2c_batch_add(b, I2C_BATCH_WRITE_BYTE, addr, val) ? 0 : -1;
+}
+
+int i2c_batch_write_word(struct i2c_batch *b, int addr, __u8 cmd, __u16 val){
+	struct i2c_batch_op *op;
+	if((op = i2c_batch_add(b, I2C_BATCH_WRITE_WORD, addr, cmd)) == NULL)
+		return -1;
+	op->buf[1] = val >> 8;
+	op->buf[2] = val & 0xff;
+	return 0;
+}
+
+static inline int i2c_batch_is_write(const struct i2c_batch_op *op){
+	return op->type == I2C_BATCH_WRITE_BYTE_DATA || 
+		   op->type == I2C_BATCH_WRITE_BYTE || 
+		   op->type == I2C_BATCH_WRITE_WORD;
+}
+
+/*Messages of the queued ops, mux framing excluded: the caller checks a 
+  batch that must go out in one I2C_RDWR fits*/
+int i2c_batch_msgs(const struct i2c_batch *b){
+	int i; int m = 0;
+	for(i=0; i<b->n; i++)
+		m += i2c_batch_is_write(&b->op[i]) ? 1 : 2;
+	return m;
+}
+
+/*Same transfers, one SMBus call per op*/
+static int i2c_batch_flush_smbus(struct i2c_batch *b){
+	int i; int ret;
+	struct i2c_batch_op *op;
+
+	for(i=0; i<b->n; i++){
+		op = &b->op[i];
+		if(i2c_set_slave(b->fd, op->addr) < 0){
+			fprintf(stderr, "Failed to configure the device; %s\n", strerror(errno));
+			return -1;
+		}
+		switch(op->type){
+			case I2C_BATCH_WRITE_BYTE_DATA:
+				ret = i2c_smbus_write_byte_data(b->fd, op->buf[0], op->buf[1]);
+				break;
+			case I2C_BATCH_WRITE_BYTE:
+				ret = i2c_smbus_write_byte(b->fd, op->buf[0]);
+				break;
+			case I2C_BATCH_WRITE_WORD:
+				ret = i2c_smbus_write_word_data(b->fd, op->buf[0], 
+											op->buf[1] | op->buf[2] << 8);
+				break;
+			case I2C_BATCH_READ_BYTE_DATA:
+				if((ret = i2c_smbus_read_byte_data(b->fd, op->buf[0])) >= 0)
+					*op->dst = ret;
+				break;
+			default:
+				if((ret = i2c_smbus_read_word_data(b->fd, op->buf[0])) >= 0)
+					*op->dst = __swab16(ret) >> op->shift;
+				break;
+		}
+		if(ret < 0){
+			fprintf(stderr, "Failed transfer to 0x%02x; %s\n", op->addr, 
+															strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*Send every queued op, returns 0 or -1 and empties the batch*/
+int i2c_batch_flush(struct i2c_batch *b){
+	int i; int first = 0; int ret = 0;
+	int base = b->mux_addr ? 1 : 0;		//msg[0] is the mux select
+	int max = I2C_RDWR_IOCTL_MAX_MSGS - base;	//room for the deselect
+	int m = base;
+	struct i2c_batch_op *op;
+	struct i2c_rdwr_ioctl_data rdwr;
+
+	if(!(b->funcs & I2C_FUNC_I2C)){
+		ret = i2c_batch_flush_smbus(b);
+		b->n = 0;
+		return ret;
+	}
+
+	for(i=0; i<=b->n; i++){
+		//an op never straddles two ioctls, its messages share a restart
+		if(i == b->n || m + 2 > max){
+			if(m == base)
+				break;
+			if(base){
+				b->msg[m].addr = b->mux_addr;
+				b->msg[m].flags = 0;
+				b->msg[m].buf = &b->mux_desel;
+				b->msg[m].len = 1;
+				m++;
+			}
+			rdwr.msgs = b->msg;
+			rdwr.nmsgs = m;
+			if(ioctl(b->fd, I2C_RDWR, &rdwr) < 0){
+				fprintf(stderr, "Failed I2C_RDWR transfer; %s\n", strerror(errno));
+				ret = -1;
+			}
+			else{
+				if(base)
+					b->mux_writes += 2;
+				for(; first<i; first++){
+					op = &b->op[first];
+					if(op->type == I2C_BATCH_READ_BYTE_DATA)
+						*op->dst = op->rbuf[0];
+					else if(op->type == I2C_BATCH_READ_WORD)
+						*op->dst = ((op->rbuf[0]<<8) | op->rbuf[1]) >> op->shift;
+				}
+			}
+			first = i;
+			m = base;
+			if(i == b->n)
+				break;
+		}
+
+		op = &b->op[i];
+		b->msg[m].addr = op->addr;
+		b->msg[m].flags = 0;
+		b->msg[m].buf = op->buf;
+		switch(op->type){
+			case I2C_BATCH_WRITE_BYTE_DATA: b->msg[m].len = 2; break;
+			case I2C_BATCH_WRITE_WORD: b->msg[m].len = 3; break;
+			default: b->msg[m].len = 1; break;
+		}
+		m++;
+		if(!i2c_batch_is_write(op)){
+			b->msg[m].addr = op->addr;
+			b->msg[m].flags = I2C_M_RD;
+			b->msg[m].buf = op->rbuf;
+			b->msg[m].len = op->type == I2C_BATCH_READ_WORD ? 2 : 1;
+			m++;
+		}
+	}
+	b->n = 0;
+	return ret;
+}
@@ -0,0 +1,108 @@
+#ifndef __I2C_BUS_H__
+#define __I2C_BUS_H__
+/*
+*	i2c_bus.h -	Bus level helpers shared by tool, hv and prec.
+*/
+#include <linux/i2c-dev.h>
+
+#define I2C_FD_MAX			256		//fds above are not tracked
+#define I2C_CACHE_FILE		"/home/hv/i2c-system/i2c-system.cache"
+#define I2C_CACHE_N_MAX		128
+#define I2C_BUS_HZ_DEFAULT	100000	//no clock-frequency in the device tree
+
+//i2c_probe() results
+#define I2C_PROBE_ABSENT	0
+#define I2C_PROBE_PRESENT	1
+#define I2C_PROBE_BUSY		2	//address claimed by a kernel driver
+
+/* Discovered topology: one entry per (adapter, address, driver). An entry 
+   with addr -1 records that the driver range was scanned and was empty. */
+struct i2c_cache_entry{
+	int adapter;
+	int addr;
+	int state;
+	char name[20];
+};
+
+struct i2c_cache{
+	struct i2c_cache_entry entry[I2C_CACHE_N_MAX];
+	int n;
+	int dirty;
+};
+
+/* A child adapter seen from its parent: channel chan of the PCA9547 at 
+   addr on adapter parent. */
+struct i2c_mux{
+	int parent;
+	int addr;
+	int chan;
+};
+
+#define I2C_MUX_SELECT				0x08	//PCA9547 control: enable | chan
+#define I2C_MUX_IDLE_DISCONNECT		-2		//pca954x idle_state
+
+/* Batch of transfers sent with I2C_RDWR, a queued op is one or two 
+   messages. The batch is split in I2C_RDWR_IOCTL_MAX_MSGS chunks and 
+   played op by op with SMBus calls when the adapter lacks I2C_FUNC_I2C. 
+   With mux_addr set (i2c_batch_mux) fd is the parent adapter and every
+   I2C_RDWR is framed by the select and the deselect of the channel. */
+#define I2C_BATCH_OP_MAX	96
+
+#define I2C_BATCH_WRITE_BYTE_DATA	0
+#define I2C_BATCH_READ_BYTE_DATA	1
+#define I2C_BATCH_READ_WORD			2	//MSB first, as the devices send it
+#define I2C_BATCH_WRITE_BYTE		3	//a lone byte, e.g. a mux control
+#define I2C_BATCH_WRITE_WORD		4	//command + MSB + LSB
+
+struct i2c_batch_op{
+	int type;
+	int addr;
+	__u8 buf[3];		//command (+ value) written
+	__u8 rbuf[2];		//data read
+	__u16 *dst;
+	int shift;			//read word is stored >> shift
+};
+
+struct i2c_batch{
+	int fd;
+	unsigned long funcs;
+	int n;
+	int mux_addr;		//0: none, fd is the child adapter
+	__u8 mux_sel;
+	__u8 mux_desel;
+	unsigned long mux_writes;	//selects + deselects sent by flushes
+	struct i2c_batch_op op[I2C_BATCH_OP_MAX];
+	struct i2c_msg msg[I2C_RDWR_IOCTL_MAX_MSGS];
+};
+
+int i2c_bus_open(int adapter);
+int i2c_bus_close(int fd);
+int i2c_set_slave(int fd, int addr);
+int i2c_bus_funcs(int fd, unsigned long *funcs);
+int i2c_bus_adapter(int fd);
+int i2c_bus_parent(int adapter);
+int i2c_bus_clock(int adapter);
+int i2c_mux_find(int adapter, struct i2c_mux *mux);
+int i2c_mux_check(struct i2c_mux *mux);
+int i2c_probe(int fd, int addr);
+int i2c_range_list(int list[], int low, int high);
+int i2c_cache_load(struct i2c_cache *c, const char *path);
+int i2c_cache_save(struct i2c_cache *c, const char *path);
+void i2c_cache_forget(struct i2c_cache *c, int adapter, const char *name);
+int i2c_cache_find(struct i2c_cache *c, int fd, int adapter, const char *name, 
+							const int *list, int addr[], int busy[], int n_max);
+int i2c_batch_init(struct i2c_batch *b, int fd);
+struct i2c_batch *i2c_bus_batch(int fd);
+int i2c_batch_mux(struct i2c_batch *b, const struct i2c_mux *mux);
+int i2c_batch_write_byte_data(struct i2c_batch *b, int addr, __u8 reg, 
+																__u8 val);
+int i2c_batch_read_byte_data(struct i2c_batch *b, int addr, __u8 reg, 
+																__u16 *dst);
+int i2c_batch_read_word(struct i2c_batch *b, int addr, __u8 cmd, __u16 *dst,
+																	int shift);
+int i2c_batch_write_byte(struct i2c_batch *b, int addr, __u8 val);
+int i2c_batch_write_word(struct i2c_batch *b, int addr, __u8 cmd, __u16 val);
+int i2c_batch_msgs(const struct i2c_batch *b);
+int i2c_batch_flush(struct i2c_batch *b);
+
+#endif
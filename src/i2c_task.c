@@ -0,0 +1,132 @@
+/*
+*	i2c_task.c -	Scheduler for resumable device transactions.
+*
+*	The drivers split their transactions at every conversion or write 
+*	cycle wait (MPL115 conversion, SHT21 measurement, EEPROM write) into
+*	steps. i2c_task_run() steps every ready task in list order and sleeps
+*	on a timerfd until the earliest pending wake up, so the waits of all
+*	the tasks overlap with each other and with the bus traffic of the 
+*	others: a cycle costs about the longest wait, not the sum of them.
+*
+*	Among the ready tasks the ones on the fd of the previous step go 
+*	first: the child busses of a mux share its wires and every change of
+*	child bus costs a select of the PCA9547 channel, so the work of one 
+*	channel is run in one stretch and the scheduler only moves to another
+*	channel when nothing is left to do on the current one.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include "i2c_task.h"
+
+void i2c_task_init(struct i2c_task *t, int (*step)(struct i2c_task *), 
+											int fd, int addr, __u16 *data){
+	memset(t, 0, sizeof(*t));
+	t->step = step;
+	t->fd = fd;
+	t->addr = addr;
+	t->data = data;
+}
+
+static inline int timespec_after(struct timespec *a, struct timespec *b){
+	return a->tv_sec > b->tv_sec || 
+			(a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+/*Wait until the absolute CLOCK_MONOTONIC time `at`*/
+static void i2c_task_sleep(int *tfd, struct timespec *at){
+	struct itimerspec its;
+	uint64_t expirations;
+
+	if(*tfd < 0)
+		*tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if(*tfd < 0){
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, at, NULL) 
+																	== EINTR);
+		return;
+	}
+	memset(&its, 0, sizeof(its));
+	its.it_value = *at;
+	timerfd_settime(*tfd, TFD_TIMER_ABSTIME, &its, NULL);
+	while(read(*tfd, &expirations, sizeof(expirations)) < 0 && errno == EINTR);
+}
+
+/*Runs the tasks to completion, returns -1 if any of them failed*/
+int i2c_task_run_bus(struct i2c_task *task[], int n, 
+												struct i2c_task_bus *bus){
+	int i; int r;
+	int left = n; int err = 0; int tfd = -1;
+	struct timespec now;
+	struct timespec *next;
+	struct i2c_task *t;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for(i=0; i<n; i++){
+		task[i]->done = 0;
+		task[i]->wake = now;
+	}
+
+	while(left > 0){
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		t = NULL;
+		for(i=0; i<n; i++){
+			if(task[i]->done || timespec_after(&task[i]->wake, &now))
+				continue;
+			if(task[i]->fd == bus->last_fd){
+				t = task[i];
+				break;
+			}
+			if(t == NULL)
+				t = task[i];
+		}
+
+		if(t == NULL){
+			next = NULL;
+			for(i=0; i<n; i++){
+				if(!task[i]->done && (next == NULL || 
+									timespec_after(next, &task[i]->wake)))
+					next = &task[i]->wake;
+			}
+			i2c_task_sleep(&tfd, next);
+			continue;
+		}
+
+		if(!t->direct && t->fd != bus->last_fd){
+			bus->last_fd = t->fd;
+			bus->switches++;
+		}
+		if((r = t->step(t)) > 0){
+			clock_gettime(CLOCK_MONOTONIC, &t->wake);
+			t->wake.tv_sec += r / 1000000;
+			t->wake.tv_nsec += (r % 1000000) * 1000L;
+			if(t->wake.tv_nsec >= 1000000000L){
+				t->wake.tv_nsec -= 1000000000L;
+				t->wake.tv_sec++;
+			}
+			continue;
+		}
+		t->done = 1;
+		t->ret = r;
+		if(r < 0)
+			err = -1;
+		left--;
+	}
+
+	if(tfd >= 0)
+		close(tfd);
+	return err;
+}
+
+int i2c_task_run(struct i2c_task *task[], int n){
+	struct i2c_task_bus bus = {.last_fd = -1};
+	return i2c_task_run_bus(task, n, &bus);
+}
+
+int i2c_task_run1(struct i2c_task *t){
+	return i2c_task_run(&t, 1);
+}
@@ -0,0 +1,46 @@
+#ifndef __I2C_TASK_H__
+#define __I2C_TASK_H__
+/*
+*	i2c_task.h -	Resumable device transactions and their scheduler.
+*/
+#include <time.h>
+#include <linux/types.h>
+
+#define I2C_TASK_DONE	0
+
+/* A task is an explicit state machine: step() does the bus work of the 
+   current state and returns I2C_TASK_DONE, a negative error, or the 
+   number of us to wait before it is stepped again (a conversion time). */
+struct i2c_task{
+	int (*step)(struct i2c_task *t);
+	int fd;
+	int addr;
+	int reg;
+	int val;
+	__u16 *data;
+	void *arg;
+	int direct;				//transfers carry their own mux select, fd
+							//isn't the kernel mux channel
+	int state;
+	int done;
+	int ret;
+	struct timespec wake;
+};
+
+/* Where a run left the bus: the fd (a mux child bus, so a mux channel) 
+   of the last step and how many times the steps moved to another fd, 
+   each move being a mux select done by the kernel. Direct tasks are left
+   out, their selects are counted by their batch. Kept across runs. */
+struct i2c_task_bus{
+	int last_fd;
+	unsigned long switches;
+};
+
+void i2c_task_init(struct i2c_task *t, int (*step)(struct i2c_task *), 
+											int fd, int addr, __u16 *data);
+int i2c_task_run(struct i2c_task *task[], int n);
+int i2c_task_run_bus(struct i2c_task *task[], int n, 
+												struct i2c_task_bus *bus);
+int i2c_task_run1(struct i2c_task *t);
+
+#endif
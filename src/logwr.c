@@ -0,0 +1,184 @@
+/*
+*	logwr.c -	Buffered log writer, see logwr.h.
+*
+*	A sample line used to cost one write() per value plus the timestamp,
+*	each one a read-modify-write of a flash page on the SD card. Lines
+*	are now built in memory and a group of them goes out in one write(),
+*	so the card sees whole pages and the process a syscall per group.
+*/
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "logwr.h"
+
+void logwr_init(struct logwr *lw, const char *prefix, const char *ext,
+												int group, int fsync_policy){
+	lw->prefix[0] = '\0';
+	strncat(lw->prefix, prefix, sizeof(lw->prefix)-1);
+	lw->ext[0] = '\0';
+	strncat(lw->ext, ext, sizeof(lw->ext)-1);
+	lw->fd = -1;
+	lw->own_fd = 1;
+	lw->mday = -1;
+	lw->rec_size = 0;
+	lw->group = group > 0 ? group : 1;
+	lw->age_max = LOGWR_AGE_MAX;
+	lw->fsync = fsync_policy;
+	lw->lines = 0;
+	lw->len = 0;
+	lw->pos = 0;
+}
+
+/*
+*	Writer on an already open fd (e.g. stdout), never rotated nor closed.
+*	Live output takes group 1, a line is seen as soon as it is complete.
+*/
+void logwr_init_fd(struct logwr *lw, int fd, int group){
+	logwr_init(lw, "", "", group, LOGWR_FSYNC_NONE);
+	lw->fd = fd;
+	lw->own_fd = 0;
+}
+
+/*"none", "commit" or "close", -1 if unknown*/
+int logwr_fsync_policy(const char *name){
+	if(!strcasecmp(name, "none"))
+		return LOGWR_FSYNC_NONE;
+	if(!strcasecmp(name, "commit"))
+		return LOGWR_FSYNC_COMMIT;
+	if(!strcasecmp(name, "close"))
+		return LOGWR_FSYNC_CLOSE;
+	return -1;
+}
+
+static int logwr_open(struct logwr *lw, struct tm *info){
+	char file_path[96];
+	struct stat st;
+	int fd;
+
+	snprintf(file_path, sizeof(file_path), "%s%s%04d-%02d-%02d.%s",
+								LOGWR_DIR, lw->prefix, info->tm_year+1900,
+								info->tm_mon+1, info->tm_mday, lw->ext);
+	fd = open(file_path, O_WRONLY|O_APPEND|O_CREAT,
+									S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if(fd < 0){
+		fprintf(stderr, "Error: can't open %s; %s\n", file_path,
+															strerror(errno));
+		return -1;
+	}
+	fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if(lw->rec_size && fstat(fd, &st) == 0 && st.st_size % lw->rec_size){
+		if(ftruncate(fd, st.st_size - st.st_size % lw->rec_size) < 0)
+			fprintf(stderr, "Error: can't trim %s; %s\n", file_path,
+															strerror(errno));
+	}
+	return fd;
+}
+
+/*Makes sure the file of the day of `now` is the open one*/
+int logwr_rotate(struct logwr *lw, time_t now){
+	struct tm info;
+
+	if(!lw->own_fd)
+		return 0;
+	localtime_r(&now, &info);
+	if(lw->fd >= 0 && info.tm_mday == lw->mday)
+		return 0;
+
+	if(lw->fd >= 0){		//midnight: the old day gets its lines first
+		logwr_flush(lw);
+		if(lw->fsync == LOGWR_FSYNC_CLOSE)
+			fdatasync(lw->fd);
+		close(lw->fd);
+	}
+	if((lw->fd = logwr_open(lw, &info)) < 0)
+		return -1;
+	lw->mday = info.tm_mday;
+	return 0;
+}
+
+/*Starts a line (a sample cycle, it may span several text lines)*/
+int logwr_line_start(struct logwr *lw, time_t now){
+	if(logwr_rotate(lw, now) < 0)
+		return -1;
+	lw->pos = lw->len;
+	if(lw->lines == 0)
+		lw->oldest = now;
+	return 0;
+}
+
+/*Free room of the line in progress, to be formatted in place*/
+char *logwr_reserve(struct logwr *lw, size_t *room){
+	*room = LOGWR_BUF_SIZE - lw->pos;
+	return lw->buf + lw->pos;
+}
+
+void logwr_advance(struct logwr *lw, size_t len){
+	lw->pos += len;
+}
+
+void logwr_append(struct logwr *lw, const void *data, size_t len){
+	if(len > LOGWR_BUF_SIZE - lw->pos)
+		len = LOGWR_BUF_SIZE - lw->pos;
+	memcpy(lw->buf + lw->pos, data, len);
+	lw->pos += len;
+}
+
+/*Ends the line and commits when it is due*/
+int logwr_line_end(struct logwr *lw){
+	lw->len = lw->pos;
+	lw->lines++;
+	if(lw->lines >= lw->group ||
+						LOGWR_BUF_SIZE - lw->len < LOGWR_LINE_MAX ||
+						time(NULL) - lw->oldest >= lw->age_max)
+		return logwr_flush(lw);
+	return 0;
+}
+
+/*Commits the complete lines*/
+int logwr_flush(struct logwr *lw){
+	size_t done = 0;
+	ssize_t ret;
+	int err = 0;
+
+	while(done < lw->len && lw->fd >= 0){
+		ret = write(lw->fd, lw->buf + done, lw->len - done);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0){
+			fprintf(stderr, "Error: log write; %s\n", strerror(errno));
+			err = -1;
+			break;
+		}
+		done += ret;
+	}
+	if(!err && lw->fsync == LOGWR_FSYNC_COMMIT && lw->len)
+		fdatasync(lw->fd);
+	//the line in progress, if any, moves to the front
+	memmove(lw->buf, lw->buf + lw->len, lw->pos - lw->len);
+	lw->pos -= lw->len;
+	lw->len = 0;
+	lw->lines = 0;
+	return err;
+}
+
+/*Commits the line in progress as it is so far, it goes on after*/
+int logwr_flush_partial(struct logwr *lw){
+	lw->len = lw->pos;
+	return logwr_flush(lw);
+}
+
+void logwr_close(struct logwr *lw){
+	logwr_flush(lw);
+	if(lw->own_fd && lw->fd >= 0){
+		if(lw->fsync != LOGWR_FSYNC_NONE)
+			fdatasync(lw->fd);
+		close(lw->fd);
+	}
+	lw->fd = -1;
+}
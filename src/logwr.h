@@ -0,0 +1,55 @@
+#ifndef __LOGWR_H__
+#define __LOGWR_H__
+/*
+*	logwr.h -	Buffered log writer with group commit and date rotation.
+*/
+#include <stddef.h>
+#include <time.h>
+
+#define LOGWR_DIR			"/home/hv/i2c-system/log/"
+#define LOGWR_BUF_SIZE		(64*1024)
+#define LOGWR_LINE_MAX		(16*1024)	//room kept for the line in progress
+#define LOGWR_GROUP			64		//default lines per commit
+#define LOGWR_AGE_MAX		60		//default s a line may wait in the buffer
+
+/*fsync policy*/
+#define LOGWR_FSYNC_NONE	0		//leave it to the kernel writeback
+#define LOGWR_FSYNC_COMMIT	1		//fdatasync() after every commit
+#define LOGWR_FSYNC_CLOSE	2		//fdatasync() on rotation and close
+
+/* Lines are formatted into buf and committed to the file with one
+   write() every `group` lines, when the oldest line is `age_max` s old
+   or when the buffer is short of room. The dated file prefixYYYY-MM-DD.ext
+   is opened by the first line of each day. */
+struct logwr{
+	char prefix[16];		//"" for a writer on a fixed fd
+	char ext[8];
+	int fd;
+	int own_fd;
+	int mday;
+	int rec_size;			//binary files: trim a torn record on open
+	int group;
+	int age_max;
+	int fsync;
+	int lines;				//complete lines in buf
+	time_t oldest;
+	size_t len;				//complete lines
+	size_t pos;				//end of the line in progress
+	char buf[LOGWR_BUF_SIZE];
+};
+
+void logwr_init(struct logwr *lw, const char *prefix, const char *ext,
+												int group, int fsync_policy);
+void logwr_init_fd(struct logwr *lw, int fd, int group);
+int logwr_fsync_policy(const char *name);
+int logwr_rotate(struct logwr *lw, time_t now);
+int logwr_line_start(struct logwr *lw, time_t now);
+char *logwr_reserve(struct logwr *lw, size_t *room);
+void logwr_advance(struct logwr *lw, size_t len);
+void logwr_append(struct logwr *lw, const void *data, size_t len);
+int logwr_line_end(struct logwr *lw);
+int logwr_flush(struct logwr *lw);
+int logwr_flush_partial(struct logwr *lw);
+void logwr_close(struct logwr *lw);
+
+#endif
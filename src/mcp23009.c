@@ -15,7 +15,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 #include "mcp23009.h"
+#include "i2c_bus.h"
 
 const char mcp23009_addr_low = 0x20;
 const char mcp23009_addr_high = 0x27;
@@ -40,7 +42,7 @@ int mcp23009_functionality(int fd){
 }
 
 int mcp23009_write_val(int fd, int addr, __u8 reg, __u8 val){
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -49,7 +51,7 @@ int mcp23009_write_val(int fd, int addr, __u8 reg, __u8 val){
 }
 
 int mcp23009_read_val(int fd, int addr, __u8 reg){
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -57,36 +59,172 @@ int mcp23009_read_val(int fd, int addr, __u8 reg){
 	return i2c_smbus_read_byte_data(fd, reg);
 }
 
+static struct mcp23009 mcp23009_sess[MCP23009_SESSION_MAX];
+static int mcp23009_sess_n;
+static pthread_mutex_t mcp23009_sess_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+*	Session of the expander at addr, its registers read on the first call
+*	(or after a drop, or when the adapter was opened again). NULL if the
+*	chip doesn't answer. The table is shared by the bus workers of tool,
+*	a session itself belongs to the worker of its adapter.
+*/
+static struct mcp23009 *mcp23009_session_locked(int fd, int addr){
+	struct mcp23009 *m = NULL;
+	int adapter = i2c_bus_adapter(fd);
+	int k;
+
+	for(k=0; k<mcp23009_sess_n; k++){
+		if(mcp23009_sess[k].adapter == adapter && 
+										mcp23009_sess[k].addr == addr){
+			if(mcp23009_sess[k].fd == fd)
+				return &mcp23009_sess[k];
+			m = &mcp23009_sess[k];
+			break;
+		}
+		if(!m && mcp23009_sess[k].fd < 0)
+			m = &mcp23009_sess[k];
+	}
+	if(!m){
+		if(mcp23009_sess_n == MCP23009_SESSION_MAX){
+			printf("Error: more than %d MCP23009 sessions\n", 
+												MCP23009_SESSION_MAX);
+			return NULL;
+		}
+		m = &mcp23009_sess[mcp23009_sess_n++];
+	}
+	m->adapter = adapter;
+	m->addr = addr;
+	m->fd = -1;
+	if(i2c_set_slave(fd, addr) < 0 || i2c_smbus_read_i2c_block_data(fd, 
+					MCP23009_REG_IODIR, MCP23009_NREG, m->reg) != MCP23009_NREG)
+		return NULL;
+	m->fd = fd;
+	return m;
+}
+
+struct mcp23009 *mcp23009_session(int fd, int addr){
+	struct mcp23009 *m;
+
+	pthread_mutex_lock(&mcp23009_sess_lock);
+	m = mcp23009_session_locked(fd, addr);
+	pthread_mutex_unlock(&mcp23009_sess_lock);
+	return m;
+}
+
+void mcp23009_drop(struct mcp23009 *m){
+	m->fd = -1;
+}
+
+/*Writes reg if val isn't what it holds already*/
+int mcp23009_config(struct mcp23009 *m, __u8 reg, __u8 val){
+	if(m->reg[reg] == val)
+		return 0;
+	if(i2c_set_slave(m->fd, m->addr) < 0 || 
+						i2c_smbus_write_byte_data(m->fd, reg, val) < 0){
+		mcp23009_drop(m);
+		return -1;
+	}
+	m->reg[reg] = val;
+	return 0;
+}
+
+/*
+*	Outputs, one OLAT write from the shadow: the other pins keep the value
+*	read when the session opened or last written by this process.
+*/
+static int mcp23009_olat(struct mcp23009 *m, __u8 val){
+	if(i2c_set_slave(m->fd, m->addr) < 0 || 
+			i2c_smbus_write_byte_data(m->fd, MCP23009_REG_OLAT, val) < 0){
+		mcp23009_drop(m);
+		return -1;
+	}
+	m->reg[MCP23009_REG_OLAT] = val;
+	return 0;
+}
+
+int mcp23009_set(struct mcp23009 *m, __u8 mask){
+	return mcp23009_olat(m, m->reg[MCP23009_REG_OLAT] | mask);
+}
+
+int mcp23009_clear(struct mcp23009 *m, __u8 mask){
+	return mcp23009_olat(m, m->reg[MCP23009_REG_OLAT] & ~mask);
+}
+
+int mcp23009_toggle(struct mcp23009 *m, __u8 mask){
+	return mcp23009_olat(m, m->reg[MCP23009_REG_OLAT] ^ mask);
+}
+
+/*
+*	Interrupt on change of the pins of mask against their previous value.
+*	INT is open-drain and active low (it can share a pulled-up line), an
+*	INTCAP read clears it. Returns the port, read last so no change is
+*	lost between the set up and the first interrupt.
+*/
+int mcp23009_int_enable(struct mcp23009 *m, __u8 mask){
+	__u8 iocon = m->reg[MCP23009_REG_IOCON];
+
+	iocon &= ~MCP23009_IOCON_INTPOL;
+	iocon |= MCP23009_IOCON_ODR | MCP23009_IOCON_INTCC;
+	if(mcp23009_config(m, MCP23009_REG_IOCON, iocon) < 0 ||
+	   mcp23009_config(m, MCP23009_REG_INTCON, 0x00) < 0 ||
+	   mcp23009_config(m, MCP23009_REG_GPINTEN, mask) < 0 ||
+	   mcp23009_read_val(m->fd, m->addr, MCP23009_REG_INTCAP) < 0)
+		return -1;
+	return mcp23009_read_val(m->fd, m->addr, MCP23009_REG_GPIO);
+}
+
+int mcp23009_int_disable(struct mcp23009 *m){
+	return mcp23009_config(m, MCP23009_REG_GPINTEN, 0x00);
+}
+
 /*
 *
 *	APPLICATION
 *
 */
 
+/*Session of an HV board expander, its pull-up and directions set*/
+struct mcp23009 *mcp23009_hv(int fd, int addr){
+	struct mcp23009 *m;
+
+	if((m = mcp23009_session(fd, addr)) == NULL ||
+	   mcp23009_config(m, MCP23009_REG_GPPU, MCP23009_HV_GPPU) < 0 ||
+	   mcp23009_config(m, MCP23009_REG_IODIR, MCP23009_HV_IODIR) < 0)
+		return NULL;
+	return m;
+}
+
 int mcp23009_read_val2(int fd, int addr, __u16 data[8]){
-	mcp23009_write_val(fd, addr, MCP23009_REG_GPPU, 0x08); //Config pull-up 
-	mcp23009_write_val(fd, addr, MCP23009_REG_IODIR, 0x17);//Config ports dir.
-	//mcp23009_write_val(fd, addr, MCP23009_REG_GPIO, 0x08);
-	data[0] = mcp23009_read_val(fd, addr, MCP23009_REG_GPIO);
+	struct mcp23009 *m;
+	int val;
+
+	if((m = mcp23009_hv(fd, addr)) == NULL)
+		return -1;
+	if((val = mcp23009_read_val(fd, addr, MCP23009_REG_GPIO)) < 0){
+		mcp23009_drop(m);
+		return -1;
+	}
+	data[0] = m->reg[MCP23009_REG_GPIO] = val;
 	return 0;
 }
 
-void mcp23009_print_val(__u16 val[8], float lsb, float conv_param[8], 
-															char *data_type[8], 
-															int i, int log, 															int log_p){
-	int bit;
-	if(!log)
-		printf("------IO------\n");
-//	printf("data: %#x\n", val[0]);
-	for(bit=0; bit<5; bit++){
-		if(log){
-			char str[16];
-			sprintf(str, "%d ", val[0]&(1<<bit)?1:0);
-			write(log_p, str, strlen(str));
-		}
-		else
-			printf("%s: %d\n", data_type[bit], val[0]&(1<<bit)?1:0);
-	}
+/*Queue the reads of INTF, INTCAP (clears INT) and GPIO into data[0..2]*/
+int mcp23009_queue_int(struct i2c_batch *b, int addr, __u16 data[8]){
+	if(i2c_batch_read_byte_data(b, addr, MCP23009_REG_INTF, &data[0]) < 0 ||
+	   i2c_batch_read_byte_data(b, addr, MCP23009_REG_INTCAP, &data[1]) < 0)
+		return -1;
+	return i2c_batch_read_byte_data(b, addr, MCP23009_REG_GPIO, &data[2]);
+}
+
+/*Configuration of a scanned expander, on its own (child) bus fd*/
+int mcp23009_setup(int fd, int addr){
+	return mcp23009_hv(fd, addr) == NULL ? -1 : 0;
+}
+
+/*The GPIO read only, mcp23009_setup() has configured the pins at scan*/
+int mcp23009_queue_val2(struct i2c_batch *b, int addr, __u16 data[8]){
+	return i2c_batch_read_byte_data(b, addr, MCP23009_REG_GPIO, &data[0]);
 }
 
 /*
@@ -1,5 +1,7 @@
 #ifndef __MCP23009_H__
 #define __MCP23009_H__
+#include <linux/types.h>
+
 //MCP23009  Registers Address
 #define MCP23009_REG_IODIR		0x00	//I/O Direction Register
 #define MCP23009_REG_IPOL 		0x01	//Input Polarity Port Register
@@ -12,5 +14,38 @@
 #define MCP23009_REG_INTCAP		0x08	//Interrut Captured Value From Port Register
 #define MCP23009_REG_GPIO		0x09	//General Purpouse I/O Port Register
 #define MCP23009_REG_OLAT		0x0a	//Output Latch Register 0
+//IOCON bits
+#define MCP23009_IOCON_SEQOP	0x20	//1: sequential operation disabled
+#define MCP23009_IOCON_ODR		0x04	//INT open-drain
+#define MCP23009_IOCON_INTPOL	0x02	//INT active high
+#define MCP23009_IOCON_INTCC	0x01	//reading INTCAP clears the interrupt
+
+#define MCP23009_NREG			11		//IODIR..OLAT
+#define MCP23009_SESSION_MAX	8
+//HV board
+#define MCP23009_HV_GPPU		0x08
+#define MCP23009_HV_IODIR		0x17	//D0-D2, D4 inputs, HVon output
+#define MCP23009_HV_ON			0x08	//GP3
+
+/* Shadow of the registers of one expander, read in one sequential
+   transfer when the session opens. The configuration is written only
+   when it changes, the outputs by a single OLAT write. A failed transfer
+   drops the session, the next one reads the chip again. */
+struct mcp23009{
+	int adapter;
+	int addr;
+	int fd;					//-1: dropped
+	__u8 reg[MCP23009_NREG];
+};
+
+struct mcp23009 *mcp23009_session(int fd, int addr);
+struct mcp23009 *mcp23009_hv(int fd, int addr);
+void mcp23009_drop(struct mcp23009 *m);
+int mcp23009_config(struct mcp23009 *m, __u8 reg, __u8 val);
+int mcp23009_set(struct mcp23009 *m, __u8 mask);
+int mcp23009_clear(struct mcp23009 *m, __u8 mask);
+int mcp23009_toggle(struct mcp23009 *m, __u8 mask);
+int mcp23009_int_enable(struct mcp23009 *m, __u8 mask);
+int mcp23009_int_disable(struct mcp23009 *m);
 
 #endif
@@ -15,6 +15,8 @@
 #include <errno.h>
 #include <pthread.h>
 #include <linux/swab.h>
+#include "i2c_bus.h"
+#include "i2c_task.h"
 
 
 /* MPL115 Registers */
@@ -49,7 +51,7 @@ int mpl115_functionality(int fd){
 
 int mpl115_convert(int fd, int addr){
 	
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -69,7 +71,7 @@ int mpl115_convert(int fd, int addr){
 int mpl115_temp(int fd, int addr){
 // temperature -5.35 C / LSB, 472 LSB is 25 C 
 	
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -93,26 +95,75 @@ int mpl115_temp(int fd, int addr){
 	return __swab16(ret)>>6;
 }
 
-pthread_mutex_t lock;
-
-int mpl115_comp_pressure(int fd, int addr, int *val_i, int *val_f){
+/*
+*	Calibration coefficients cache. A0, B1, B2 and C12 are factory 
+*	constants: they are read once per device, keyed by adapter and 
+*	address, and read again only after a bus error on that device. A 
+*	sample is then CONVERT, wait, and one 4 byte read of PADC and TADC.
+*/
+#define MPL115_COEF_N	8
 
-	int ret;
-	__u16 tadc; __u16 padc;
+struct mpl115_coef{
+	int adapter;
+	int addr;
+	int valid;
 	__s16 a0; __s16 b1; 
 	__s16 b2; __s16 c12;
-	int a1; int y1; int pcomp;
-	unsigned pressure_kPa;
-	
-	if(pthread_mutex_init(&lock, NULL) != 0){
-		printf("Failed to mutex init\n");
-		return EXIT_FAILURE;
+};
+
+static struct mpl115_coef mpl115_coef[MPL115_COEF_N];
+static int mpl115_coef_n = 0;
+static pthread_mutex_t mpl115_coef_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct mpl115_coef *mpl115_coef_get(int fd, int addr){
+	int i;
+	int adapter = i2c_bus_adapter(fd);
+	struct mpl115_coef *c = NULL;
+	__u8 buf[8];
+
+	pthread_mutex_lock(&mpl115_coef_lock);
+	for(i=0; i<mpl115_coef_n; i++){
+		if(mpl115_coef[i].adapter == adapter && mpl115_coef[i].addr == addr){
+			c = &mpl115_coef[i];
+			break;
+		}
 	}
-	pthread_mutex_lock(&lock);
+	if(c == NULL && mpl115_coef_n < MPL115_COEF_N){
+		c = &mpl115_coef[mpl115_coef_n++];
+		c->adapter = adapter;
+		c->addr = addr;
+		c->valid = 0;
+	}
+	pthread_mutex_unlock(&mpl115_coef_lock);
+	if(c == NULL){
+		printf("Error: too many MPL115\n");
+		return NULL;
+	}
+	if(c->valid)
+		return c;
 
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
-		return EXIT_FAILURE;
+		return NULL;
+	}
+	if(i2c_smbus_read_i2c_block_data(fd, MPL115_A0, 8, buf) != 8){
+		printf("Failed to read coefficients; %s\n", strerror(errno));
+		return NULL;
+	}
+	c->a0 = (buf[0]<<8) | buf[1];
+	c->b1 = (buf[2]<<8) | buf[3];
+	c->b2 = (buf[4]<<8) | buf[5];
+	c->c12 = (buf[6]<<8) | buf[7];
+	c->valid = 1;
+	return c;
+}
+
+static int mpl115_start(int fd, int addr){
+	int ret;
+
+	if( i2c_set_slave(fd, addr) < 0 ){
+		printf("Failed to configure the device; %s\n", strerror(errno));
+		return -1;
 	}
 
 	ret = i2c_smbus_write_byte_data(fd, MPL115_CONVERT, 0);
@@ -120,49 +171,76 @@ int mpl115_comp_pressure(int fd, int addr, int *val_i, int *val_f){
 		printf("Failed to start conversion; %s\n", strerror(errno));
 		return ret;	
 	}
-	
-	usleep(MPL115_CONVERSION_TIME_MAX);
-	
-	ret = i2c_smbus_read_word_data(fd, MPL115_TADC);
-	if(ret < 0)	
-		return ret;	 
-	tadc = __swab16(ret) >> 6;
-	
-	ret = i2c_smbus_read_word_data(fd, MPL115_PADC);
-	if(ret < 0)
-		return ret;	 
-	padc = __swab16(ret) >> 6;
-	
-	ret  = i2c_smbus_read_word_data(fd, MPL115_A0);
-	if(ret < 0)
-		return ret;	 
-	a0 = __swab16(ret);
-	
-	ret  = i2c_smbus_read_word_data(fd, MPL115_B1);
-	if(ret < 0)
-		return ret;	 
-	b1 = __swab16(ret);
-	
-	ret  = i2c_smbus_read_word_data(fd, MPL115_B2);
-	if(ret < 0)
-		return ret;	 
-	b2 = __swab16(ret);
-	
-	ret = i2c_smbus_read_word_data(fd, MPL115_C12);
-	if(ret < 0)
-		return ret;	 
-	c12 = __swab16(ret);
+	return 0;
+}
 
-	pthread_mutex_unlock(&lock);
-    pthread_mutex_destroy(&lock);
-	
-	a1 = b1 + ((c12 * tadc) >> 11);
-    y1 = (a0 << 10) + a1 * padc;
+/*Read PADC and TADC (10 bit) in one transfer*/
+static int mpl115_read_adc(int fd, int addr, __u16 *padc, __u16 *tadc){
+	__u8 buf[4];
+
+	if( i2c_set_slave(fd, addr) < 0 ){
+		printf("Failed to configure the device; %s\n", strerror(errno));
+		return -1;
+	}
+	if(i2c_smbus_read_i2c_block_data(fd, MPL115_PADC, 4, buf) != 4){
+		printf("Failed to read pressure data; %s\n", strerror(errno));
+		return -1;
+	}
+	*padc = ((buf[0]<<8) | buf[1]) >> 6;
+	*tadc = ((buf[2]<<8) | buf[3]) >> 6;
+	return 0;
+}
+
+/*Compensated pressure in kPa with 4 fractional bits*/
+static unsigned mpl115_compensate(struct mpl115_coef *c, __u16 padc, 
+																__u16 tadc){
+	int a1; int y1; int pcomp;
+
+	a1 = c->b1 + ((c->c12 * tadc) >> 11);
+    y1 = (c->a0 << 10) + a1 * padc;
     
 	/* compensated pressure with 4 fractional bits */
-    pcomp = (y1 + ((b2 * (int) tadc) >> 1)) >> 9;
+    pcomp = (y1 + ((c->b2 * (int) tadc) >> 1)) >> 9;
     
-	pressure_kPa = pcomp * (115 - 50) / 1023 + (50 << 4);
+	return pcomp * (115 - 50) / 1023 + (50 << 4);
+}
+
+/*
+*	Pressure sample as a task: CONVERT, yield for the conversion time,
+*	then fetch and compensate into data[0] (kPa, 4 fractional bits).
+*/
+int mpl115_press_step(struct i2c_task *t){
+	__u16 tadc; __u16 padc;
+	struct mpl115_coef *c;
+
+	if((c = mpl115_coef_get(t->fd, t->addr)) == NULL)
+		return -1;
+
+	if(t->state == 0){
+		if(mpl115_start(t->fd, t->addr) < 0){
+			c->valid = 0;		//re-read the coefficients next time
+			return -1;
+		}
+		t->state = 1;
+		return MPL115_CONVERSION_TIME_MAX;
+	}
+
+	if(mpl115_read_adc(t->fd, t->addr, &padc, &tadc) < 0){
+		c->valid = 0;
+		return -1;
+	}
+	t->data[0] = mpl115_compensate(c, padc, tadc); 
+	return I2C_TASK_DONE;
+}
+
+int mpl115_comp_pressure(int fd, int addr, int *val_i, int *val_f){
+
+	__u16 pressure_kPa;
+	struct i2c_task t;
+	
+	i2c_task_init(&t, mpl115_press_step, fd, addr, &pressure_kPa);
+	if(i2c_task_run1(&t) < 0)
+		return EXIT_FAILURE;
 	
 	*val_i = pressure_kPa >> 4;
 	*val_f = (pressure_kPa & 15) * (1000000 >> 4);
@@ -176,89 +254,15 @@ int mpl115_comp_pressure(int fd, int addr, int *val_i, int *val_f){
 *
 */
 int mpl115_press(int fd, int addr, __u16 *data){
+	struct i2c_task t;
 
-	int ret;
-	__u16 tadc; __u16 padc;
-	__s16 a0; __s16 b1; 
-	__s16 b2; __s16 c12;
-	int a1; int y1; int pcomp;
-	unsigned pressure_kPa;
-	
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
-		printf("Failed to configure the device; %s\n", strerror(errno));
+	i2c_task_init(&t, mpl115_press_step, fd, addr, data);
+	if(i2c_task_run1(&t) < 0)
 		return EXIT_FAILURE;
-	}
-
-	ret = i2c_smbus_write_byte_data(fd, MPL115_CONVERT, 0);
-	if(ret < 0){
-		printf("Failed to start conversion; %s\n", strerror(errno));
-		return ret;	
-	}
-	
-	usleep(MPL115_CONVERSION_TIME_MAX);
-	
-	ret = i2c_smbus_read_word_data(fd, MPL115_TADC);
-	if(ret < 0)	
-		return ret;	 
-	tadc = __swab16(ret) >> 6;
-	
-	ret = i2c_smbus_read_word_data(fd, MPL115_PADC);
-	if(ret < 0)
-		return ret;	 
-	padc = __swab16(ret) >> 6;
-	
-	ret  = i2c_smbus_read_word_data(fd, MPL115_A0);
-	if(ret < 0)
-		return ret;	 
-	a0 = __swab16(ret);
-	
-	ret  = i2c_smbus_read_word_data(fd, MPL115_B1);
-	if(ret < 0)
-		return ret;	 
-	b1 = __swab16(ret);
-	
-	ret  = i2c_smbus_read_word_data(fd, MPL115_B2);
-	if(ret < 0)
-		return ret;	 
-	b2 = __swab16(ret);
-	
-	ret = i2c_smbus_read_word_data(fd, MPL115_C12);
-	if(ret < 0)
-		return ret;	 
-	c12 = __swab16(ret);
-	
-	a1 = b1 + ((c12 * tadc) >> 11);
-    y1 = (a0 << 10) + a1 * padc;
-    
-	/* compensated pressure with 4 fractional bits */
-    pcomp = (y1 + ((b2 * (int) tadc) >> 1)) >> 9;
-    
-	pressure_kPa = pcomp * (115 - 50) / 1023 + (50 << 4);
-	
- 	data[0] = pressure_kPa; 
 	return 0;
 }
 
 
-void mpl115_print_val(__u16 val[8], float lsb, float conv_param[8], 
-															char *data_type[8], 
-															int ch, int log, 
-															int log_p){
-
-	int val_i = val[0] >> 4;
-	int val_f = (val[0] & 15) * (1000000 >> 4);
-	char tmp[20];
-	sprintf(tmp, "%d.%d", val_i, val_f);
-	float tmp2 = atof(tmp);
-	if(log){
-		char str[16];
-		sprintf(str, "%0.3f ", tmp2);
-		write(log_p, str, strlen(str));
-	}
-	else
-		printf("%s%d: %0.3f kPa\n", data_type[0], ch, tmp2);
-}
-
 /*
 int main(int argc, char *argv[]){
 
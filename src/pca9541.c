@@ -0,0 +1,214 @@
+/*
+*	pca9541.c -	Bus ownership of a PCA9541 master selector from user
+*				space, see pca9541.h.
+*
+*	The kernel pca9541 driver arbitrates on every transfer of its child
+*	adapter and gives the bus back after it: a board read as 8 SMBus
+*	calls is 8 arbitrations, each of them a chance to lose against the
+*	other master. Here the bus is acquired once, with the arbitration
+*	of the kernel driver (NXP AN10383) and a bounded exponential backoff
+*	between the polls, the whole batch runs on the upstream adapter and
+*	the bus is released at the end.
+*
+*	The registers are accessed with I2C_RDWR so the selector needs no
+*	I2C_SLAVE claim. The kernel driver must not be bound to it, it would
+*	release the bus in the middle of a batch.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include "pca9541.h"
+
+#define PCA9541_CONTROL			0x01
+#define PCA9541_ISTAT			0x02
+
+#define PCA9541_CTL_MYBUS		(1 << 0)
+#define PCA9541_CTL_NMYBUS		(1 << 1)
+#define PCA9541_CTL_BUSON		(1 << 2)
+#define PCA9541_CTL_NBUSON		(1 << 3)
+#define PCA9541_CTL_BUSINIT		(1 << 4)
+#define PCA9541_CTL_TESTON		(1 << 6)
+#define PCA9541_CTL_NTESTON		(1 << 7)
+
+#define PCA9541_ISTAT_NMYTEST	(1 << 7)
+
+#define PCA9541_DELAY_MIN		50			//us, first poll interval
+#define PCA9541_DELAY_MAX		1000		//us, backoff cap
+#define PCA9541_FORCE_NS		125000000LL	//then take the bus anyway
+#define PCA9541_FAIL_NS			250000000LL	//then give up
+
+/*Control value that turns the bus on for us, from its current state*/
+static const __u8 pca9541_control[16] = {
+	4, 0, 1, 5, 4, 4, 5, 5, 0, 0, 1, 1, 0, 4, 5, 1
+};
+
+static inline int mybus(int reg){
+	return !(reg & PCA9541_CTL_MYBUS) == !(reg & PCA9541_CTL_NMYBUS);
+}
+
+static inline int busoff(int reg){
+	return !(reg & PCA9541_CTL_BUSON) == !(reg & PCA9541_CTL_NBUSON);
+}
+
+static int pca9541_read(struct pca9541 *m, __u8 reg){
+	__u8 val;
+	struct i2c_msg msg[2] = {
+		{.addr = m->addr, .flags = 0, .len = 1, .buf = &reg},
+		{.addr = m->addr, .flags = I2C_M_RD, .len = 1, .buf = &val},
+	};
+	struct i2c_rdwr_ioctl_data rdwr = {.msgs = msg, .nmsgs = 2};
+
+	if(ioctl(m->fd, I2C_RDWR, &rdwr) < 0)
+		return -1;
+	return val;
+}
+
+static int pca9541_write(struct pca9541 *m, __u8 reg, __u8 val){
+	__u8 buf[2] = {reg, val};
+	struct i2c_msg msg = {.addr = m->addr, .flags = 0, .len = 2, .buf = buf};
+	struct i2c_rdwr_ioctl_data rdwr = {.msgs = &msg, .nmsgs = 1};
+
+	return ioctl(m->fd, I2C_RDWR, &rdwr) < 0 ? -1 : 0;
+}
+
+static long long pca9541_now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/*Checks the kernel driver isn't bound and takes the lock of the selector*/
+int pca9541_open(struct pca9541 *m, int fd, int adapter, int addr){
+	char path[96];
+
+	memset(m, 0, sizeof(*m));
+	m->fd = fd;
+	m->adapter = adapter;
+	m->addr = addr;
+	m->lock_fd = -1;
+
+	snprintf(path, sizeof(path), "/sys/bus/i2c/devices/%d-%04x/driver",
+															adapter, addr);
+	if(access(path, F_OK) == 0){
+		fprintf(stderr, "Error: the kernel drives the PCA9541 %d-%04x: "
+				"echo %d-%04x > /sys/bus/i2c/drivers/pca9541/unbind\n",
+										adapter, addr, adapter, addr);
+		return -1;
+	}
+	snprintf(path, sizeof(path), PCA9541_LOCK_DIR "i2c-%d-%02x.lock",
+															adapter, addr);
+	if((m->lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666)) < 0){
+		fprintf(stderr, "Error: can't open %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+*	One poll of the arbitration: 1 when the bus is ours, 0 to poll again
+*	after *delay us, -1 on a bus error. force takes the bus from the
+*	other master (it kept it past PCA9541_FORCE_NS).
+*/
+static int pca9541_arbitrate(struct pca9541 *m, int force, int *delay){
+	int reg; int istat;
+
+	if((reg = pca9541_read(m, PCA9541_CONTROL)) < 0)
+		return -1;
+
+	if(busoff(reg)){
+		//off: turn it on for us unless the other master asked for it
+		if((istat = pca9541_read(m, PCA9541_ISTAT)) < 0)
+			return -1;
+		if(!(istat & PCA9541_ISTAT_NMYTEST) || force){
+			if(pca9541_write(m, PCA9541_CONTROL, pca9541_control[reg & 0x0f]
+												| PCA9541_CTL_NTESTON) < 0)
+				return -1;
+			*delay = PCA9541_DELAY_MIN;
+		}
+		else
+			*delay = PCA9541_DELAY_MAX;	//give it time to take it
+	}
+	else if(mybus(reg)){
+		if(reg & (PCA9541_CTL_NTESTON | PCA9541_CTL_BUSINIT)){
+			if(pca9541_write(m, PCA9541_CONTROL, reg &
+						~(PCA9541_CTL_NTESTON | PCA9541_CTL_BUSINIT)) < 0)
+				return -1;
+		}
+		return 1;
+	}
+	else if(force){					//other master kept it too long
+		if(pca9541_write(m, PCA9541_CONTROL, pca9541_control[reg & 0x0f]
+						| PCA9541_CTL_BUSINIT | PCA9541_CTL_NTESTON) < 0)
+			return -1;
+		m->forced++;
+	}
+	else if(!(reg & PCA9541_CTL_NTESTON)){	//ask for it
+		if(pca9541_write(m, PCA9541_CONTROL, reg | PCA9541_CTL_NTESTON) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*Waits for the bus, returns 0 when it is ours, -1 after 250 ms*/
+int pca9541_acquire(struct pca9541 *m){
+	long long start = pca9541_now();
+	long long elapsed = 0;
+	int delay = PCA9541_DELAY_MIN;
+	int next; int ret;
+	struct timespec ts;
+
+	if(m->lock_fd >= 0)
+		flock(m->lock_fd, LOCK_EX);
+	do{
+		next = delay;
+		if((ret = pca9541_arbitrate(m, elapsed >= PCA9541_FORCE_NS,
+															&next)) != 0)
+			break;
+		ts.tv_sec = 0;
+		ts.tv_nsec = next * 1000L;
+		nanosleep(&ts, NULL);
+		if(next == delay && delay < PCA9541_DELAY_MAX)	//backoff
+			delay = delay*2 < PCA9541_DELAY_MAX ? delay*2 : PCA9541_DELAY_MAX;
+		elapsed = pca9541_now() - start;
+	}while(elapsed < PCA9541_FAIL_NS);
+
+	m->wait_ns = pca9541_now() - start;
+	if(ret == 1){
+		m->acquired++;
+		if(m->wait_ns > m->wait_max_ns)
+			m->wait_max_ns = m->wait_ns;
+		return 0;
+	}
+	m->failed++;
+	fprintf(stderr, "Error: PCA9541 %d-%04x: %s\n", m->adapter, m->addr,
+				ret < 0 ? strerror(errno) : "no bus ownership after 250 ms");
+	if(m->lock_fd >= 0)
+		flock(m->lock_fd, LOCK_UN);
+	return -1;
+}
+
+/*Turns the bus off if it is ours*/
+int pca9541_release(struct pca9541 *m){
+	int reg; int ret = 0;
+
+	reg = pca9541_read(m, PCA9541_CONTROL);
+	if(reg >= 0 && !busoff(reg) && mybus(reg))
+		ret = pca9541_write(m, PCA9541_CONTROL,
+											(reg & PCA9541_CTL_NBUSON) >> 1);
+	if(m->lock_fd >= 0)
+		flock(m->lock_fd, LOCK_UN);
+	return reg < 0 ? -1 : ret;
+}
+
+void pca9541_close(struct pca9541 *m){
+	if(m->lock_fd >= 0)
+		close(m->lock_fd);
+	m->lock_fd = -1;
+}
@@ -0,0 +1,29 @@
+#ifndef __PCA9541_H__
+#define __PCA9541_H__
+/*
+*	pca9541.h -	Bus ownership of a PCA9541 master selector from user space.
+*/
+#include <linux/types.h>
+
+#define PCA9541_LOCK_DIR	"/run/lock/"
+
+/* Arbitration of one PCA9541 on the upstream adapter fd: acquire once,
+   run a whole batch on the downstream bus, release. Times are ns. */
+struct pca9541{
+	int fd;
+	int adapter;
+	int addr;
+	int lock_fd;			//flock between our own processes
+	long long wait_ns;		//time to ownership of the last acquire
+	long long wait_max_ns;
+	unsigned long acquired;
+	unsigned long forced;	//taken from the other master after 125 ms
+	unsigned long failed;
+};
+
+int pca9541_open(struct pca9541 *m, int fd, int adapter, int addr);
+int pca9541_acquire(struct pca9541 *m);
+int pca9541_release(struct pca9541 *m);
+void pca9541_close(struct pca9541 *m);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+*	query.c -	Time range aggregates over the binary logs.
+*
+*	The daily .bin files are mapped read-only. Their records have a fixed
+*	size and are appended in time order, so the record itself is the time
+*	index: the start of the range is found by bisection on ts and the scan
+*	stops at the first record past its end. Nothing is parsed, nothing is
+*	built beforehand.
+*
+*	The eight codes of a record are one 128-bit vector: min, max and sum
+*	of all the channels are a few vector instructions per record (NEON on
+*	the Pi, SSE2 on a PC) through the GCC vector extensions. Percentiles
+*	come from a histogram of the raw codes, exact and in a single pass.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "binlog.h"
+#include "logwr.h"
+#include "query.h"
+
+typedef __u16 v8hu __attribute__((vector_size(16)));
+typedef __u32 v8su __attribute__((vector_size(32)));
+
+#define QUERY_SUM_FOLD		65536	//records before v8su sums may overflow
+
+struct query_acc{
+	v8hu min;
+	v8hu max;
+	v8su sum;
+	__u32 sum_n;
+};
+
+static void query_fold(struct query_grp *g, struct query_acc *a){
+	int ch;
+	for(ch=0; ch<8; ch++)
+		g->sum[ch] += a->sum[ch];
+	a->sum = (v8su){0};
+	a->sum_n = 0;
+}
+
+static int query_grp_get(struct query *q, struct query_acc acc[],
+													int adapter, int inst){
+	int k;
+	struct query_grp *g;
+
+	for(k=0; k<q->grp_n; k++){
+		if(q->grp[k].adapter == adapter && q->grp[k].inst == inst)
+			return k;
+	}
+	if(q->grp_n == QUERY_GRP_MAX)
+		return -1;
+	g = &q->grp[q->grp_n];
+	memset(g, 0, sizeof(*g));
+	g->adapter = adapter;
+	g->inst = inst;
+	if((g->hist = calloc(65536, sizeof(__u32))) == NULL)
+		return -1;
+	memset(&acc[q->grp_n], 0, sizeof(acc[0]));
+	acc[q->grp_n].min = ~(v8hu){0};
+	return q->grp_n++;
+}
+
+/*First record with ts >= t*/
+static size_t query_bisect(const struct binlog_rec *rec, size_t n, __u64 t){
+	size_t lo = 0; size_t hi = n; size_t mid;
+	while(lo < hi){
+		mid = lo + (hi - lo)/2;
+		if(rec[mid].ts < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int query_file(struct query *q, const char *path, __u64 from,
+											__u64 to, struct query_acc acc[]){
+	const struct binlog_rec *rec;
+	const struct binlog_rec *r;
+	struct stat st;
+	size_t n; size_t k; size_t len;
+	v8hu v; v8hu m;
+	__u16 b = q->code_signed ? 0x8000 : 0;
+	v8hu bias = {b, b, b, b, b, b, b, b};
+	int fd; int g = -1; int last_adapter = -1; int last_inst = -1;
+
+	if((fd = open(path, O_RDONLY)) < 0){
+		if(errno == ENOENT)		//no log that day
+			return 0;
+		fprintf(stderr, "Error: can't open %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+	if(fstat(fd, &st) < 0 || (n = st.st_size / BINLOG_REC_SIZE) == 0){
+		close(fd);
+		return 0;
+	}
+	len = n * BINLOG_REC_SIZE;
+	rec = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(rec == MAP_FAILED){
+		fprintf(stderr, "Error: can't map %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	k = query_bisect(rec, n, from);
+	madvise((void*)rec, len, MADV_SEQUENTIAL);
+	for(; k<n && rec[k].ts <= to; k++){
+		r = &rec[k];
+		if(r->dev != q->dev || (r->addr & BINLOG_BUSY) ||
+					(q->adapter != QUERY_ANY && r->adapter != q->adapter))
+			continue;
+		if(!binlog_check((struct binlog_rec*)r)){
+			q->bad++;
+			continue;
+		}
+		if(r->adapter != last_adapter || r->inst != last_inst){
+			g = query_grp_get(q, acc, r->adapter, r->inst);
+			last_adapter = r->adapter;
+			last_inst = r->inst;
+		}
+		if(g < 0)
+			continue;
+
+		memcpy(&v, r->val, sizeof(v));
+		v ^= bias;
+		m = (v8hu)(v < acc[g].min);
+		acc[g].min = (acc[g].min & ~m) | (v & m);
+		m = (v8hu)(v > acc[g].max);
+		acc[g].max = (acc[g].max & ~m) | (v & m);
+		acc[g].sum += __builtin_convertvector(v, v8su);
+		if(++acc[g].sum_n == QUERY_SUM_FOLD)
+			query_fold(&q->grp[g], &acc[g]);
+		q->grp[g].hist[v[q->ch]]++;
+		q->grp[g].n++;
+	}
+	munmap((void*)rec, len);
+	return 0;
+}
+
+/*Scans the daily files from q->from to q->to, returns the groups found*/
+int query_run(struct query *q){
+	static struct query_acc acc[QUERY_GRP_MAX];
+	char path[96];
+	struct tm day;
+	time_t t;
+	int g; int ch;
+	__u64 from = (__u64)q->from * 1000000000ULL;
+	__u64 to = (__u64)q->to * 1000000000ULL + 999999999ULL;
+
+	q->grp_n = 0;
+	q->bad = 0;
+	localtime_r(&q->from, &day);
+	day.tm_hour = day.tm_min = day.tm_sec = 0;
+	day.tm_isdst = -1;
+	for(t = mktime(&day); t <= q->to; t = mktime(&day)){
+		localtime_r(&t, &day);
+		snprintf(path, sizeof(path), "%s%s%04d-%02d-%02d.bin", LOGWR_DIR,
+							q->prefix, day.tm_year+1900, day.tm_mon+1,
+							day.tm_mday);
+		if(query_file(q, path, from, to, acc) < 0)
+			return -1;
+		day.tm_mday++;			//mktime() normalizes the month
+		day.tm_hour = day.tm_min = day.tm_sec = 0;
+		day.tm_isdst = -1;
+	}
+
+	for(g=0; g<q->grp_n; g++){
+		query_fold(&q->grp[g], &acc[g]);
+		for(ch=0; ch<8; ch++){
+			q->grp[g].min[ch] = acc[g].min[ch];
+			q->grp[g].max[ch] = acc[g].max[ch];
+		}
+	}
+	return q->grp_n;
+}
+
+/*Raw code (signed for the signed devices) of a biased aggregate*/
+double query_code(struct query *q, double biased){
+	return q->code_signed ? biased - 0x8000 : biased;
+}
+
+/*p-th percentile (0..100) of the channel asked for, as a raw code*/
+double query_percentile(struct query *q, struct query_grp *g, double p){
+	__u64 target; __u64 count = 0;
+	int code;
+
+	if(g->n == 0)
+		return 0;
+	target = (__u64)ceil(p/100 * g->n);
+	if(target == 0)
+		target = 1;
+	for(code=0; code<65536; code++){
+		count += g->hist[code];
+		if(count >= target)
+			break;
+	}
+	return query_code(q, code);
+}
+
+void query_free(struct query *q){
+	int g;
+	for(g=0; g<q->grp_n; g++){
+		free(q->grp[g].hist);
+		q->grp[g].hist = NULL;
+	}
+	q->grp_n = 0;
+}
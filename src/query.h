@@ -0,0 +1,44 @@
+#ifndef __QUERY_H__
+#define __QUERY_H__
+/*
+*	query.h -	Time range aggregates over the binary logs.
+*/
+#include <time.h>
+#include <linux/types.h>
+
+#define QUERY_GRP_MAX		64
+#define QUERY_ANY			-1
+
+/* One device instance (adapter, inst) matched by a query. min, max and
+   sum are kept in raw codes for the 8 channels, hist for the channel
+   asked for. Codes of signed devices are stored biased by 0x8000 so the
+   unsigned order is the signed one, query_code() takes the bias off. */
+struct query_grp{
+	int adapter;
+	int inst;
+	__u64 n;
+	__u16 min[8];
+	__u16 max[8];
+	__u64 sum[8];
+	__u32 *hist;			//65536 bins
+};
+
+struct query{
+	const char *prefix;		//hv, sensors or ""
+	int dev;				//BINLOG_* id
+	int ch;
+	int adapter;			//or QUERY_ANY
+	int code_signed;
+	time_t from;
+	time_t to;
+	long bad;				//records failing the CRC
+	struct query_grp grp[QUERY_GRP_MAX];
+	int grp_n;
+};
+
+int query_run(struct query *q);
+double query_code(struct query *q, double biased);
+double query_percentile(struct query *q, struct query_grp *g, double p);
+void query_free(struct query *q);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+*	ramp.c -	HV setpoint ramp with ADC feedback, see ramp.h.
+*
+*	A ramp used to be one hv process per code, each one opening the bus
+*	and looking up the devices: hundreds of milliseconds between a step
+*	and the first current seen after it. Here the fd is opened once, the
+*	feedback is one I2C_RDWR of 4 conversions (~2 ms at 100 kHz) and the
+*	loop never sleeps, so a step is checked within a few milliseconds.
+*	The code due is computed from the time ramped so far (pauses not
+*	counted), a slow read doesn't slow the ramp down, it takes bigger
+*	steps.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include "ramp.h"
+#include "func_reg.h"
+
+static long long ramp_now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/*Largest of the two HV currents of the last read, uA*/
+static inline float ramp_current(struct ramp *r){
+	return (r->fb[0] > r->fb[1] ? r->fb[0] : r->fb[1]) * r->adc_ua_code;
+}
+
+static int ramp_read(struct ramp *r){
+	if(ads7828_queue_ch(&r->batch, r->adc_addr, RAMP_FB_MASK, r->fb) < 0 ||
+										i2c_batch_flush(&r->batch) < 0){
+		fprintf(stderr, "Error: ramp feedback read failed; %s\n",
+															strerror(errno));
+		return -1;
+	}
+	r->reads++;
+	return 0;
+}
+
+static void ramp_print(struct ramp *r, long long t, __u16 code){
+	printf("%0.3f %0.3f %0.3f %0.3f %0.3f %0.3f\n", t/1e9, code*r->kv_code,
+			r->fb[3]*r->adc_kv_code, r->fb[2]*r->adc_kv_code,
+			r->fb[0]*r->adc_ua_code, r->fb[1]*r->adc_ua_code);
+}
+
+/*Sets up the feedback batch, the unit factors and rate are the caller's*/
+int ramp_init(struct ramp *r, int fd, int dac_addr, int dac_ch,
+														int adc_addr){
+	memset(r, 0, sizeof(*r));
+	r->fd = fd;
+	r->dac_addr = dac_addr;
+	r->dac_ch = dac_ch;
+	r->adc_addr = adc_addr;
+	return i2c_batch_init(&r->batch, fd);
+}
+
+/*
+*	Ramps to the code to, prints "t Vset VHVp VHVn IHVp IHVn" on every
+*	step. Returns 0 at the target, -1 on abort (the last code is held).
+*/
+int ramp_run(struct ramp *r, __u16 to){
+	__u16 dac[8];
+	__u16 from; __u16 code; __u16 due;
+	long long t0; long long now; long long t_write = 0;
+	long long pause_at = 0;
+	double code_ns;				//codes per ns
+	long long k;
+	int dir; int paused = 0;
+	float i;
+
+	if(r->rate <= 0){
+		fprintf(stderr, "Error: ramp rate must be positive\n");
+		return -1;
+	}
+	if(ad5694_queue_ch(&r->batch, r->dac_addr, 1u << r->dac_ch, dac) < 0 ||
+										i2c_batch_flush(&r->batch) < 0){
+		fprintf(stderr, "Error: can't read the DAC back; %s\n",
+															strerror(errno));
+		return -1;
+	}
+	from = code = dac[r->dac_ch];
+	dir = to > from ? 1 : -1;
+	code_ns = r->rate / 1000 / r->kv_code / 1e9;
+	printf("time Vset VHVp VHVn IHVp IHVn\n");
+
+	t0 = ramp_now();
+	while(1){
+		if(ramp_read(r) < 0)
+			return -1;
+		now = ramp_now();
+		r->elapsed_ns = now - t0;
+		if(t_write){				//first read after a step
+			r->lat_ns += now - t_write;
+			if(now - t_write > r->lat_max_ns)
+				r->lat_max_ns = now - t_write;
+			t_write = 0;
+			ramp_print(r, now - t0, code);
+		}
+		if(code == to)
+			break;
+		if(r->cancel && *r->cancel){
+			fprintf(stderr, "ramp: cancelled at %0.3f kV\n", code*r->kv_code);
+			return -1;
+		}
+
+		i = ramp_current(r);
+		if(r->limit > 0 && i > r->limit * RAMP_ABORT){
+			fprintf(stderr, "ramp: aborted at %0.3f kV, %0.3f uA\n",
+													code*r->kv_code, i);
+			return -1;
+		}
+		if(r->limit > 0 && (i > r->limit ||
+							(paused && i > r->limit * RAMP_RESUME))){
+			if(!paused){
+				paused = 1;
+				pause_at = now;
+				r->pauses++;
+				fprintf(stderr, "ramp: paused at %0.3f kV, %0.3f uA\n",
+													code*r->kv_code, i);
+			}
+			else if(now - pause_at > RAMP_HOLD_MAX_NS){
+				r->paused_ns += now - pause_at;
+				fprintf(stderr, "ramp: aborted at %0.3f kV, over %0.3f uA "
+						"for %lld s\n", code*r->kv_code, r->limit,
+											RAMP_HOLD_MAX_NS/1000000000LL);
+				return -1;
+			}
+			continue;
+		}
+		if(paused){
+			paused = 0;
+			r->paused_ns += now - pause_at;
+		}
+
+		k = (now - t0 - r->paused_ns) * code_ns;
+		if(k >= (to - from) * dir)
+			due = to;
+		else
+			due = from + dir * k;
+		if(due == code)
+			continue;
+		if(ad5694_write_ch(r->fd, r->dac_addr, r->dac_ch, due) != 0){
+			fprintf(stderr, "Error: DAC write failed; %s\n", strerror(errno));
+			return -1;
+		}
+		t_write = ramp_now();
+		code = due;
+		r->steps++;
+	}
+	return 0;
+}
+
+/*Steps, pauses and step to feedback latency, to stderr*/
+void ramp_report(struct ramp *r){
+	fprintf(stderr, "ramp: %lu steps in %0.3f s (%0.3f s paused, %lu pauses),"
+			" %lu feedback reads\n", r->steps, r->elapsed_ns/1e9,
+			r->paused_ns/1e9, r->pauses, r->reads);
+	fprintf(stderr, "ramp: step to feedback %0.3f ms mean, %0.3f ms max\n",
+			r->steps ? r->lat_ns/1e6/r->steps : 0, r->lat_max_ns/1e6);
+}
@@ -0,0 +1,48 @@
+#ifndef __RAMP_H__
+#define __RAMP_H__
+/*
+*	ramp.h -	HV setpoint ramp with ADC feedback.
+*/
+#include <signal.h>
+#include <linux/types.h>
+#include "i2c_bus.h"
+
+#define RAMP_FB_MASK		0x0f		//IHVp, IHVn, VHVn, VHVp
+#define RAMP_RESUME			0.9			//resume below limit*RAMP_RESUME
+#define RAMP_ABORT			1.5			//abort above limit*RAMP_ABORT
+#define RAMP_HOLD_MAX_NS	10000000000LL	//or when paused that long
+
+/* The AD5694 channel ch walks from its current code to the target at
+   rate, one code at a time, on one open fd. Between two steps the
+   feedback channels of the ADS7828 are converted back to back: above
+   limit the ramp pauses (the code is held), it goes on below
+   limit*RAMP_RESUME; it aborts above limit*RAMP_ABORT or after
+   RAMP_HOLD_MAX_NS of pause. Times are ns. */
+struct ramp{
+	int fd;
+	int dac_addr;
+	int dac_ch;
+	int adc_addr;
+	float kv_code;				//DAC kV per code
+	float adc_kv_code;			//ADC kV per code (VHVp, VHVn)
+	float adc_ua_code;			//ADC uA per code (IHVp, IHVn)
+	float rate;					//V/s
+	float limit;				//uA, 0: none
+	const volatile sig_atomic_t *cancel;
+	struct i2c_batch batch;
+	__u16 fb[8];
+	unsigned long steps;
+	unsigned long reads;
+	unsigned long pauses;
+	long long paused_ns;
+	long long lat_ns;			//DAC write to the end of the next read
+	long long lat_max_ns;
+	long long elapsed_ns;
+};
+
+int ramp_init(struct ramp *r, int fd, int dac_addr, int dac_ch,
+														int adc_addr);
+int ramp_run(struct ramp *r, __u16 to);
+void ramp_report(struct ramp *r);
+
+#endif
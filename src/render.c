@@ -0,0 +1,321 @@
+/*
+*	render.c -	Output of a converted sample cycle, see render.h.
+*
+*	The whole cycle is serialized into the caller's buffer, nothing is
+*	allocated and nothing is written: the caller does one write() (or
+*	logwr commit) per cycle. Numbers go through render_fixed(), integer
+*	arithmetic with 3 decimals like the "%0.3f" it replaces, without the
+*	printf machinery.
+*/
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include "render.h"
+
+int render_format(const char *name){
+	if(!strcasecmp(name, "text"))
+		return RENDER_TEXT;
+	if(!strcasecmp(name, "log"))
+		return RENDER_LOG;
+	if(!strcasecmp(name, "csv"))
+		return RENDER_CSV;
+	if(!strcasecmp(name, "json"))
+		return RENDER_JSON;
+	if(!strcasecmp(name, "influx"))
+		return RENDER_INFLUX;
+	return -1;
+}
+
+/*Log file extension of a format*/
+const char *render_ext(int fmt){
+	switch(fmt){
+		case RENDER_CSV: return "csv";
+		case RENDER_JSON: return "jsonl";
+		case RENDER_INFLUX: return "influx";
+		default: return "log";
+	}
+}
+
+static inline char *put_str(char *p, const char *s){
+	while(*s)
+		*p++ = *s++;
+	return p;
+}
+
+/*data_type names are padded with spaces for the terminal ("D0  ")*/
+static inline char *put_name(char *p, const char *s){
+	while(*s && *s != ' ')
+		*p++ = *s++;
+	return p;
+}
+
+static char *put_uint(char *p, unsigned long long u){
+	char tmp[20];
+	int n = 0;
+	do{
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	}while(u);
+	while(n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+static inline char *put_int(char *p, long long v){
+	if(v < 0){
+		*p++ = '-';
+		return put_uint(p, -(unsigned long long)v);
+	}
+	return put_uint(p, v);
+}
+
+/*v on width digits, zero padded*/
+static inline char *put_pad(char *p, int v, int width){
+	int k;
+	for(k=width-1; k>=0; k--){
+		p[k] = '0' + v % 10;
+		v /= 10;
+	}
+	return p + width;
+}
+
+/*v with 3 decimals, rounded half away from zero*/
+char *render_fixed(char *p, float v){
+	long long m;
+	int frac;
+
+	if(isnan(v))
+		return put_str(p, "nan");
+	if(fabsf(v) > 1e15)
+		return put_str(p, v < 0 ? "-inf" : "inf");
+	m = llround((double)v * 1000);
+	if(m < 0){
+		*p++ = '-';
+		m = -m;
+	}
+	p = put_uint(p, m / 1000);
+	*p++ = '.';
+	frac = m % 1000;
+	*p++ = '0' + frac / 100;
+	*p++ = '0' + frac / 10 % 10;
+	*p++ = '0' + frac % 10;
+	return p;
+}
+
+/*YYYY-MM-DDTHH:MM:SS, local time as the log file names*/
+static char *put_time(char *p, const struct tm *tm){
+	p = put_pad(p, tm->tm_year + 1900, 4);
+	*p++ = '-';
+	p = put_pad(p, tm->tm_mon + 1, 2);
+	*p++ = '-';
+	p = put_pad(p, tm->tm_mday, 2);
+	*p++ = 'T';
+	p = put_pad(p, tm->tm_hour, 2);
+	*p++ = ':';
+	p = put_pad(p, tm->tm_min, 2);
+	*p++ = ':';
+	return put_pad(p, tm->tm_sec, 2);
+}
+
+/*Instance: its name or its number*/
+static inline char *put_inst(char *p, const struct render_item *it){
+	if(it->name)
+		return put_str(p, it->name);
+	return put_int(p, it->inst);
+}
+
+static inline int want_ch(const struct render_item *it, int ch){
+	return !it->ch_mask || (it->ch_mask & (1u << ch));
+}
+
+/*Value of channel ch: a bit of val[0] or a converted unit*/
+static inline char *put_val(char *p, const struct render_item *it, int ch){
+	if(it->bits){
+		*p++ = it->val[0] & (1 << ch) ? '1' : '0';
+		return p;
+	}
+	return render_fixed(p, it->unit[ch]);
+}
+
+static char *render_text(char *p, const struct render_item *it){
+	int ch;
+
+	if(it->busy){
+		p = put_str(p, it->data_type[0]);
+		if(it->name)
+			*p++ = ' ';
+		p = put_inst(p, it);
+		return put_str(p, ": 0\n");
+	}
+	if(it->title){
+		p = put_str(p, it->title);
+		if(it->name){
+			*p++ = ' ';
+			p = put_str(p, it->name);
+		}
+		*p++ = '\n';
+	}
+	for(ch=0; ch<it->nch; ch++){
+		if(!want_ch(it, ch))
+			continue;
+		p = put_str(p, it->data_type[ch]);
+		if(!it->title){
+			if(it->name)
+				*p++ = ' ';
+			p = put_inst(p, it);
+		}
+		*p++ = ':';
+		*p++ = ' ';
+		p = put_val(p, it, ch);
+		if(it->unit_name && it->unit_name[ch]){
+			*p++ = ' ';
+			p = put_str(p, it->unit_name[ch]);
+		}
+		*p++ = '\n';
+	}
+	return p;
+}
+
+static char *render_log(char *p, const struct render_item *it){
+	int ch;
+
+	if(it->busy)
+		return put_str(p, "0 ");
+	for(ch=0; ch<it->nch; ch++){
+		if(!want_ch(it, ch))
+			continue;
+		p = put_val(p, it, ch);
+		*p++ = ' ';
+	}
+	return p;
+}
+
+static char *render_csv(char *p, const struct render_item *it, 
+														const char *time){
+	int ch;
+
+	for(ch=0; ch<it->nch; ch++){
+		if(!want_ch(it, ch))
+			continue;
+		p = put_str(p, time);
+		*p++ = ',';
+		p = put_int(p, it->adapter);
+		*p++ = ',';
+		p = put_str(p, it->dev);
+		*p++ = ',';
+		p = put_inst(p, it);
+		*p++ = ',';
+		p = put_name(p, it->data_type[ch]);
+		*p++ = ',';
+		p = put_val(p, it, ch);
+		*p++ = '\n';
+	}
+	return p;
+}
+
+static char *render_json(char *p, const struct render_item *it, 
+														const char *time){
+	int ch;
+
+	p = put_str(p, "{\"time\":\"");
+	p = put_str(p, time);
+	p = put_str(p, "\",\"adapter\":");
+	p = put_int(p, it->adapter);
+	p = put_str(p, ",\"device\":\"");
+	p = put_str(p, it->dev);
+	p = put_str(p, "\",\"instance\":");
+	if(it->name){
+		*p++ = '"';
+		p = put_str(p, it->name);
+		*p++ = '"';
+	}
+	else
+		p = put_int(p, it->inst);
+	for(ch=0; ch<it->nch; ch++){
+		if(!want_ch(it, ch))
+			continue;
+		p = put_str(p, ",\"");
+		p = put_name(p, it->data_type[ch]);
+		p = put_str(p, "\":");
+		if(!it->bits && !isfinite(it->unit[ch]))
+			p = put_str(p, "null");
+		else
+			p = put_val(p, it, ch);
+	}
+	return put_str(p, "}\n");
+}
+
+/*Line protocol has no nan nor inf: those fields are left out, the line
+  too if none is left*/
+static char *render_influx(char *p, const struct render_item *it, 
+												unsigned long long ns){
+	char *start = p;
+	int ch; char sep = ' ';
+
+	p = put_str(p, it->dev);
+	p = put_str(p, ",adapter=");
+	p = put_int(p, it->adapter);
+	p = put_str(p, ",instance=");
+	p = put_inst(p, it);
+	for(ch=0; ch<it->nch; ch++){
+		if(!want_ch(it, ch) || (!it->bits && !isfinite(it->unit[ch])))
+			continue;
+		*p++ = sep;
+		sep = ',';
+		p = put_name(p, it->data_type[ch]);
+		*p++ = '=';
+		p = put_val(p, it, ch);
+		if(it->bits)
+			*p++ = 'i';
+	}
+	if(sep == ' ')
+		return start;
+	*p++ = ' ';
+	p = put_uint(p, ns);
+	*p++ = '\n';
+	return p;
+}
+
+/*
+*	Serializes the items *k.. of the n of a cycle sampled at ts 
+*	(CLOCK_REALTIME) into buf, returns the length. *k is left on the
+*	first item that didn't fit (n: all done), the caller commits buf and
+*	calls again for the rest of the cycle.
+*/
+size_t render_cycle(int fmt, const struct timespec *ts,
+							const struct render_item *it, int n, int *k,
+										char *buf, size_t size){
+	char time[24];
+	char *p = buf;
+	char *end = buf + size;
+	struct tm tm;
+	unsigned long long ns;
+
+	localtime_r(&ts->tv_sec, &tm);
+	*put_time(time, &tm) = '\0';
+	ns = (unsigned long long)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+
+	if(end - p <= RENDER_ITEM_MAX)
+		return 0;
+	if(fmt == RENDER_LOG && *k == 0){
+		p = put_str(p, time);
+		p = put_str(p, "; ");
+	}
+	for(; *k<n; ++*k){
+		const struct render_item *i = &it[*k];
+		if(end - p <= RENDER_ITEM_MAX)
+			return p - buf;
+		if((i->busy || i->held) && fmt != RENDER_TEXT && fmt != RENDER_LOG)
+			continue;
+		switch(fmt){
+			case RENDER_TEXT: p = render_text(p, i); break;
+			case RENDER_LOG: p = render_log(p, i); break;
+			case RENDER_CSV: p = render_csv(p, i, time); break;
+			case RENDER_JSON: p = render_json(p, i, time); break;
+			case RENDER_INFLUX: p = render_influx(p, i, ns); break;
+		}
+	}
+	if(fmt == RENDER_LOG)
+		*p++ = '\n';
+	return p - buf;
+}
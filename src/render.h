@@ -0,0 +1,49 @@
+#ifndef __RENDER_H__
+#define __RENDER_H__
+/*
+*	render.h -	Output of a converted sample cycle.
+*/
+#include <stddef.h>
+#include <time.h>
+#include <linux/types.h>
+
+#define RENDER_TEXT		0		//human readable, the terminal layout
+#define RENDER_LOG		1		//"timestamp; v v v ..." log line
+#define RENDER_CSV		2		//time,adapter,device,instance,channel,value
+#define RENDER_JSON		3		//JSON lines, an object per device instance
+#define RENDER_INFLUX	4		//Influx line protocol
+
+#define RENDER_ITEM_MAX	1024	//worst case bytes of one item, any format
+#define RENDER_CSV_HEADER	"time,adapter,device,instance,channel,value\n"
+
+/* One device instance of the cycle. Descriptor part: title is the text
+   layout header (NULL: one "name<inst>: value" line per channel), bits
+   means the channels are the bits of val[0] (GPIO). name replaces the
+   instance number when set, ch_mask keeps a subset of the channels (0:
+   all). held items were not sampled this cycle: the text and log layouts
+   repeat their last values, the record formats leave them out. */
+struct render_item{
+	const char *dev;
+	const char *title;
+	char * const *data_type;
+	char * const *unit_name;
+	int nch;
+	int bits;
+	int adapter;
+	int inst;
+	const char *name;
+	unsigned ch_mask;
+	int busy;
+	int held;
+	const __u16 *val;
+	const float *unit;
+};
+
+int render_format(const char *name);
+const char *render_ext(int fmt);
+char *render_fixed(char *p, float v);
+size_t render_cycle(int fmt, const struct timespec *ts,
+							const struct render_item *it, int n, int *k,
+										char *buf, size_t size);
+
+#endif
@@ -10,10 +10,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
 #include <linux/swab.h>
+#include "i2c_bus.h"
+#include "i2c_task.h"
 
 /* SHT21 Commands */
 #define SHT21_TRIG_T_MEASUR_HM		0xe3
@@ -70,7 +73,7 @@ int sht21_functionality(int fd){
 
 int sht21_read_value(int fd, int addr, __u8 reg){
 	
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -83,7 +86,7 @@ int sht21_read_value(int fd, int addr, __u8 reg){
 
 int sht21_write_value(int fd, int addr, __u8 reg, __u8 val){
 
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -94,46 +97,195 @@ int sht21_write_value(int fd, int addr, __u8 reg, __u8 val){
 		return i2c_smbus_write_byte_data(fd, reg, val);
 }
 
-pthread_mutex_t lock;
+/*
+*	Non blocking measurement: sht21_trigger() starts a no hold master 
+*	measurement and sht21_fetch() picks the result up. The sensor NACKs 
+*	its address until the conversion is done, so fetch polls instead of 
+*	sleeping the worst case time and the bus stays free for the other 
+*	devices meanwhile.
+*
+*	Self heating: the sensor must not be active more than 10% of the 
+*	time (datasheet 2.4). A trigger arriving before 10x the duration of
+*	the previous measurement has passed starts nothing, the last value 
+*	of that measurement type is returned instead.
+*/
+#define SHT21_DUTY_CYCLE_DIV	10
+#define SHT21_POLL_TIME			2000	//us
+#define SHT21_STATE_N			8
+#define SHT21_BUSY				1
 
-int sht21_measur(int fd, int addr, __u8 reg){
-	
-	int data[2];
+struct sht21_state{
+	int fd;
+	int addr;
+	__u8 cmd;					//measurement in flight
+	int pending;
+	struct timespec start;		//start of the last measurement
+	long meas_time;				//its max duration, us
+	__u16 val[2];				//last T and RH raw values
+	int valid[2];
+};
 
-	if(pthread_mutex_init(&lock, NULL) != 0){
-		printf("Failed to mutex init\n");
-		return EXIT_FAILURE;
+static struct sht21_state sht21_state[SHT21_STATE_N];
+static int sht21_state_n = 0;
+static pthread_mutex_t sht21_state_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int sht21_is_temp(__u8 cmd){
+	return cmd == SHT21_TRIG_T_MEASUR_NH || cmd == SHT21_TRIG_T_MEASUR_HM;
+}
+
+static long sht21_elapsed_us(struct timespec *t){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec)*1000000L + 
+										(now.tv_nsec - t->tv_nsec)/1000;
+}
+
+static struct sht21_state *sht21_state_get(int fd, int addr){
+	int i;
+	struct sht21_state *st = NULL;
+
+	pthread_mutex_lock(&sht21_state_lock);
+	for(i=0; i<sht21_state_n; i++){
+		if(sht21_state[i].fd == fd && sht21_state[i].addr == addr){
+			st = &sht21_state[i];
+			break;
+		}
 	}
+	if(st == NULL && sht21_state_n < SHT21_STATE_N){
+		st = &sht21_state[sht21_state_n++];
+		memset(st, 0, sizeof(*st));
+		st->fd = fd;
+		st->addr = addr;
+	}
+	pthread_mutex_unlock(&sht21_state_lock);
+	if(st == NULL)
+		printf("Error: too many SHT21\n");
+	return st;
+}
+
+/*CRC-8, polynomial x^8+x^5+x^4+1 (datasheet 5.7)*/
+static __u8 sht21_crc8(__u8 *data, int len){
+	__u8 crc = 0;
+	int i; int bit;
+	for(i=0; i<len; i++){
+		crc ^= data[i];
+		for(bit=0; bit<8; bit++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+	}
+	return crc;
+}
+
+/*Returns 0 when a measurement runs or isn't needed, SHT21_BUSY when the
+  duty cycle doesn't allow one yet and there is no value to serve*/
+int sht21_trigger(int fd, int addr, __u8 reg){
+	struct sht21_state *st;
 
-	pthread_mutex_lock(&lock);
+	if(!sht21_is_temp(reg) && reg != SHT21_TRIG_RH_MEASUR_NH && 
+											reg != SHT21_TRIG_RH_MEASUR_HM)
+		return -1;
+	if((st = sht21_state_get(fd, addr)) == NULL)
+		return -1;
+	if(st->pending)
+		return 0;
+	if(st->meas_time && sht21_elapsed_us(&st->start) < 
+								st->meas_time*SHT21_DUTY_CYCLE_DIV)
+		return st->valid[!sht21_is_temp(reg)] ? 0 : SHT21_BUSY;
 
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
-		return EXIT_FAILURE;
+		return -1;
 	}
-		
 	if(i2c_smbus_write_byte(fd, reg) < 0){
 		printf("Failed writing to device; %s\n", strerror(errno));
-		return EXIT_FAILURE;
+		return -1;
 	}
-	
-	if(reg == SHT21_TRIG_T_MEASUR_NH || reg == SHT21_TRIG_T_MEASUR_HM)
-		usleep(SHT21_MEAS_TIME_TEMPERATURE);
-	else if(reg == SHT21_TRIG_RH_MEASUR_NH || reg == SHT21_TRIG_RH_MEASUR_HM)
-		usleep(SHT21_MEAS_TIME_HUMIDITY);
-	else
-		return EXIT_FAILURE;
-	
-	data[0] = i2c_smbus_read_byte(fd);
-	data[1] = i2c_smbus_read_byte(fd);
+	clock_gettime(CLOCK_MONOTONIC, &st->start);
+	st->cmd = reg;
+	st->meas_time = sht21_is_temp(reg) ? SHT21_MEAS_TIME_TEMPERATURE : 
+										 SHT21_MEAS_TIME_HUMIDITY;
+	st->pending = 1;
+	return 0;
+}
 
-	usleep(500000); //to guarantee a maximum of two measurments
-				    //per second at 12 bit acuracy (datasheet 2.4)
+/*Returns 0 and the raw value, SHT21_BUSY while converting, -1 on error*/
+int sht21_fetch(int fd, int addr, __u8 reg, __u16 *data){
+	struct sht21_state *st;
+	__u8 buf[3];
+	int type;
 
-	pthread_mutex_unlock(&lock);
-    pthread_mutex_destroy(&lock);
+	if((st = sht21_state_get(fd, addr)) == NULL)
+		return -1;
+	if(st->pending){
+		if( i2c_set_slave(fd, addr) < 0 ){
+			printf("Failed to configure the device; %s\n", strerror(errno));
+			return -1;
+		}
+		if(read(fd, buf, 3) != 3){	//NACK while the conversion runs
+			if(sht21_elapsed_us(&st->start) < 2*st->meas_time)
+				return SHT21_BUSY;
+			st->pending = 0;
+			printf("Failed reading the measurement; %s\n", strerror(errno));
+			return -1;
+		}
+		st->pending = 0;
+		if(sht21_crc8(buf, 2) != buf[2]){
+			printf("Error: SHT21 CRC mismatch\n");
+			return -1;
+		}
+		type = !sht21_is_temp(st->cmd);
+		st->val[type] = (buf[0]<<8) | buf[1];
+		st->valid[type] = 1;
+		if(sht21_is_temp(st->cmd) != sht21_is_temp(reg))
+			return SHT21_BUSY;	//the other measurement type was in flight
+	}
+	type = !sht21_is_temp(reg);
+	if(!st->valid[type])
+		return -1;
+	*data = st->val[type];
+	return 0;
+}
 
-	return (data[0]<<8) | data[1];
+/*Time to the next useful fetch or trigger attempt, us*/
+static long sht21_wait_us(int fd, int addr){
+	struct sht21_state *st;
+	long wait;
+
+	if((st = sht21_state_get(fd, addr)) == NULL)
+		return SHT21_POLL_TIME;
+	if(st->pending)			//first look at 3/4 of the max time
+		wait = st->meas_time*3/4 - sht21_elapsed_us(&st->start);
+	else					//duty cycle
+		wait = st->meas_time*SHT21_DUTY_CYCLE_DIV - 
+											sht21_elapsed_us(&st->start);
+	return wait < SHT21_POLL_TIME ? SHT21_POLL_TIME : wait;
+}
+
+/*Measurement t->reg as a task, the raw value goes to t->data[0]*/
+int sht21_measur_step(struct i2c_task *t){
+	int ret;
+
+	ret = sht21_trigger(t->fd, t->addr, t->reg);
+	if(ret == 0)
+		ret = sht21_fetch(t->fd, t->addr, t->reg, t->data);
+	if(ret == SHT21_BUSY)
+		return sht21_wait_us(t->fd, t->addr);
+	return ret < 0 ? -1 : I2C_TASK_DONE;
+}
+
+int sht21_humid_step(struct i2c_task *t){
+	t->reg = SHT21_TRIG_RH_MEASUR_NH;
+	return sht21_measur_step(t);
+}
+
+int sht21_measur(int fd, int addr, __u8 reg){
+	__u16 data;
+	struct i2c_task t;
+
+	i2c_task_init(&t, sht21_measur_step, fd, addr, &data);
+	t.reg = reg;
+	if(i2c_task_run1(&t) < 0)
+		return EXIT_FAILURE;
+	return data;
 }
 
 int sht21_humid(int fd, int addr, __u16 *data){ 
@@ -141,20 +293,6 @@ int sht21_humid(int fd, int addr, __u16 *data){
 	return 0;
 }
 
-void sht21_print_val(__u16 val[8], float lsb, float conv_param[8], 
-															char *data_type[8], 
-															int ch, int log, 
-															int log_p){
-	float humid = sht21_rh_ticks_to_per_cent_mille(val[0])/1000;
-	if(log){
-		char str[16];
-		sprintf(str, "%0.3f ", humid);
-		write(log_p, str, strlen(str));
-	}
-	else
-		printf("%s%d: %0.3f %%\n", data_type[0], ch, humid);
-}
-
 /*
 int main(int argc, char *argv[]){
 
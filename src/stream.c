@@ -0,0 +1,179 @@
+/*
+*	stream.c -	Back to back ADC conversions into a ring buffer, see
+*				stream.h.
+*
+*	A conversion of the ADS7828 is a command write and a 2 byte read with
+*	a repeated start, two messages: I2C_RDWR takes 42, so 21 conversions
+*	go in one ioctl (20 with the mux select and deselect around them).
+*	The reader queues as many whole frames as fit and flushes them at
+*	once, the bus only idles for the syscall between two transfers. The
+*	ring is allocated once, the reader never allocates nor blocks on the
+*	consumer.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include "binlog.h"
+#include "stream.h"
+
+#define STREAM_RING_MASK	(STREAM_RING_FRAMES - 1)
+
+static __u64 stream_ts(__u64 from, __u64 to, int k, int n){
+	return from + (to - from) * (k + 1) / n;
+}
+
+static void *stream_run(void *arg){
+	struct stream *s = arg;
+	__u16 val[I2C_RDWR_IOCTL_MAX_MSGS/2][8];
+	int fpb = (I2C_RDWR_IOCTL_MAX_MSGS - (s->batch.mux_addr ? 2 : 0))/2 / 
+													s->nch;	//frames per ioctl
+	unsigned long head = s->head;
+	__u64 last = binlog_now(); __u64 now;
+	struct timespec retry = {0, STREAM_RETRY_NS};
+	int k; int fail = 0;
+
+	if(fpb < 1)
+		fpb = 1;
+	memset(val, 0, sizeof(val));
+	while(!s->stop){
+		for(k=0; k<fpb; k++)
+			s->queue_ch(&s->batch, s->addr, s->mask, val[k]);
+		if(i2c_batch_flush(&s->batch) < 0){
+			s->errors++;
+			if(++fail >= STREAM_FAIL_MAX){
+				fprintf(stderr, "Error: stream stopped after %d failed "
+												"transfers in a row\n", fail);
+				s->failed = 1;
+				break;
+			}
+			nanosleep(&retry, NULL);
+			last = binlog_now();
+			continue;
+		}
+		fail = 0;
+		now = binlog_now();
+		for(k=0; k<fpb; k++){
+			if(head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) >=
+														STREAM_RING_FRAMES){
+				s->dropped++;
+				continue;
+			}
+			s->ring[head & STREAM_RING_MASK].ts = stream_ts(last, now, k, fpb);
+			memcpy(s->ring[head & STREAM_RING_MASK].val, val[k],
+															sizeof(val[k]));
+			head++;
+		}
+		__atomic_store_n(&s->head, head, __ATOMIC_RELEASE);
+		last = now;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &s->end);
+	return NULL;
+}
+
+/*Starts the reader thread on the channels of mask of the ADC at addr, 
+  through the parent adapter fd when mux is given (i2c_batch_mux)*/
+int stream_start(struct stream *s, int fd, const struct i2c_mux *mux, 
+		int addr, unsigned mask, 
+		int (*queue_ch)(struct i2c_batch*, int, unsigned, __u16[8]), 
+																int decim){
+	int ch;
+
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+	s->addr = addr;
+	s->mask = mask;
+	s->queue_ch = queue_ch;
+	s->decim = decim > 0 ? decim : 1;
+	for(ch=0; ch<8; ch++)
+		s->nch += (mask >> ch) & 1;
+	if(s->nch == 0){
+		fprintf(stderr, "Error: no channel to stream\n");
+		return -1;
+	}
+	i2c_batch_init(&s->batch, fd);
+	if(mux && i2c_batch_mux(&s->batch, mux) < 0)
+		return -1;
+	if((s->ring = malloc(STREAM_RING_FRAMES * sizeof(s->ring[0]))) == NULL){
+		fprintf(stderr, "Error: no memory for the stream ring\n");
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &s->start);
+	if((errno = pthread_create(&s->thread, NULL, stream_run, s)) != 0){
+		fprintf(stderr, "Error: can't start the stream; %s\n", strerror(errno));
+		free(s->ring);
+		s->ring = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*Takes up to n_max frames out of the ring, returns how many*/
+int stream_drain(struct stream *s, struct stream_frame *out, int n_max){
+	unsigned long head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+	unsigned long tail = s->tail;
+	int n = 0;
+
+	for(; tail != head && n < n_max; tail++, n++)
+		out[n] = s->ring[tail & STREAM_RING_MASK];
+	__atomic_store_n(&s->tail, tail, __ATOMIC_RELEASE);
+	return n;
+}
+
+/*Averages decim frames into out, 1 when out is complete. ts is the one of
+  the last frame of the block.*/
+int stream_decimate(struct stream *s, const struct stream_frame *in,
+												struct stream_frame *out){
+	int ch;
+
+	if(s->decim == 1){
+		*out = *in;
+		return 1;
+	}
+	for(ch=0; ch<8; ch++)
+		s->acc[ch] += in->val[ch];
+	if(++s->acc_n < s->decim)
+		return 0;
+	out->ts = in->ts;
+	for(ch=0; ch<8; ch++){
+		out->val[ch] = (s->acc[ch] + s->decim/2) / s->decim;
+		s->acc[ch] = 0;
+	}
+	s->acc_n = 0;
+	return 1;
+}
+
+void stream_stop(struct stream *s){
+	s->stop = 1;
+	if(!s->joined && pthread_join(s->thread, NULL) == 0)
+		s->joined = 1;
+}
+
+/*Achieved rate against what the bus clock allows, to stderr. Only after
+  stream_stop(): the reader sets end on its way out and the ring is freed*/
+void stream_report(struct stream *s, int adapter){
+	double sec; double conv;
+	unsigned long frames;
+	int hz;
+
+	if(!s->joined){
+		fprintf(stderr, "Error: stream reader still running, ring kept\n");
+		return;
+	}
+	sec = (s->end.tv_sec - s->start.tv_sec) +
+								(s->end.tv_nsec - s->start.tv_nsec)/1e9;
+	frames = s->head + s->dropped;
+	hz = i2c_bus_clock(i2c_bus_parent(adapter));
+	conv = sec > 0 ? frames * s->nch / sec : 0;
+
+	fprintf(stderr, "stream i2c-%d 0x%02x: %lu frames in %0.3f s, "
+			"%0.1f frames/s, %0.1f conversions/s, %lu dropped, %lu failed "
+			"transfers\n", adapter, s->addr, frames, sec,
+			sec > 0 ? frames/sec : 0, conv, s->dropped, s->errors);
+	fprintf(stderr, "stream i2c-%d 0x%02x: %0.1f%% of the %d Hz bus "
+			"(%d bits per conversion)\n", adapter, s->addr,
+			conv * STREAM_CONV_BITS * 100 / hz, hz, STREAM_CONV_BITS);
+	free(s->ring);
+	s->ring = NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+/*
+*	stream.h -	Back to back ADC conversions into a ring buffer.
+*/
+#include <pthread.h>
+#include <time.h>
+#include <linux/types.h>
+#include "i2c_bus.h"
+
+#define STREAM_RING_FRAMES	(1<<16)		//power of 2, ~30 s of 3 channels
+#define STREAM_CONV_BITS	47			//I2C bits of one ADS7828 conversion
+#define STREAM_RETRY_NS		10000000	//wait after a failed transfer
+#define STREAM_FAIL_MAX		100			//failed in a row: the reader stops
+
+/* One frame: a conversion of every channel of mask, ts interpolated
+   between the ends of the transfers around it (CLOCK_REALTIME ns). */
+struct stream_frame{
+	__u64 ts;
+	__u16 val[8];
+};
+
+/* A reader thread converts the channels of mask back to back, as many
+   frames per I2C_RDWR as the kernel takes, and puts them in ring. A frame
+   that finds the ring full is dropped, the bus never waits for the
+   consumer. head is written by the reader only, tail by the consumer
+   only. decim frames are averaged into one by stream_decimate(). A 
+   failed transfer is retried after STREAM_RETRY_NS, STREAM_FAIL_MAX of
+   them in a row end the reader with failed set. */
+struct stream{
+	int fd;
+	int addr;
+	unsigned mask;
+	int nch;
+	int (*queue_ch)(struct i2c_batch*, int, unsigned, __u16[8]);
+	struct stream_frame *ring;
+	unsigned long head;
+	unsigned long tail;
+	unsigned long dropped;
+	unsigned long errors;			//failed transfers
+	volatile int stop;
+	volatile int failed;			//the reader gave up
+	int joined;						//stream_stop() joined the reader
+	pthread_t thread;
+	struct timespec start;
+	struct timespec end;
+	struct i2c_batch batch;
+	int decim;
+	int acc_n;
+	__u32 acc[8];
+};
+
+int stream_start(struct stream *s, int fd, const struct i2c_mux *mux, 
+		int addr, unsigned mask, 
+		int (*queue_ch)(struct i2c_batch*, int, unsigned, __u16[8]), 
+																int decim);
+int stream_drain(struct stream *s, struct stream_frame *out, int n_max);
+int stream_decimate(struct stream *s, const struct stream_frame *in,
+												struct stream_frame *out);
+void stream_stop(struct stream *s);
+void stream_report(struct stream *s, int adapter);
+
+#endif
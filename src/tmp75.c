@@ -14,6 +14,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <linux/swab.h>
+#include "i2c_bus.h"
 
 /*TMP75 Registers*/
 #define TMP75_REG_TEMP		0x00
@@ -78,7 +79,7 @@ int tmp75_functionality(int fd){
 	
 int tmp75_read_value(int fd, int addr, __u8 reg){
 	
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -91,7 +92,7 @@ int tmp75_read_value(int fd, int addr, __u8 reg){
 
 int tmp75_write_value(int fd, int addr, __u8 reg, __u16 value){
 	
-	if( ioctl(fd, I2C_SLAVE, addr) < 0 ){
+	if( i2c_set_slave(fd, addr) < 0 ){
 		printf("Failed to configure the device; %s\n", strerror(errno));
 		return EXIT_FAILURE;
 	}
@@ -110,18 +111,11 @@ int tmp75_temp(int fd, int addr, __u16 *data){
 	return 0;
 }
 
-void tmp75_print_val(__u16 val[8], float lsb, float conv_param[8], 
-															char *data_type[8], 
-															int ch, int log, 
-															int log_p){
-	if(log){
-		char str[16];
-		sprintf(str, "%0.3f ", TMP75_TEMP_FROM_REG_12BIT(val[0]));
-		write(log_p, str, strlen(str));
-	}
-	else
-		printf("%s%d: %0.3f C\n", data_type[0], ch, 
-											 TMP75_TEMP_FROM_REG_12BIT(val[0]));
+int tmp75_queue_temp(struct i2c_batch *b, int addr, __u16 *data){
+	if(i2c_batch_write_byte_data(b, addr, TMP75_REG_CONFIG, 
+											TMP75_RESOLUTION_BITS_12) < 0)
+		return -1;
+	return i2c_batch_read_word(b, addr, TMP75_REG_TEMP, &data[0], 0);
 }
 
 /*
@@ -24,113 +24,233 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 #include <linux/i2c-dev.h>
 #include "func_reg.h"
 #include "mcp23009.h"
+#include "i2c_bus.h"
+#include "i2c_task.h"
+#include "binlog.h"
+#include "logwr.h"
+#include "query.h"
+#include "conv.h"
+#include "render.h"
 
 #define MODE_AUTO       0
 #define MODE_QUICK      1
 #define MODE_READ       2
 #define MODE_FUNC       3
 
-#define CONFIG_FILE_LINE_MAX 	20
-#define SUBSYS_N_MAX 			8
+#define CONFIG_FILE_LINE_MAX 	256
+#define SUBSYS_N_MAX 			10
+#define NODE_N_MAX				32
+
+#define CONFIG_FILE	"/home/hv/i2c-system/i2c-system.conf"
 
 struct device{
 	char name[20];
+	int id;							//BINLOG_* id in the binary log
 	char *data_type[8];
 	int addr_low;
 	int addr_high;
+	int (*setup_val)(int, int);			//once at scan, on the child bus
+	int (*step_val)(struct i2c_task*);	//read_val with conversion waits
 	int (*read_val)(int, int, __u16[8]);
-	void (*print_val)(__u16[8], float, float*, char*[8], int, int, int);
+	int (*queue_val)(struct i2c_batch*, int, __u16[8]);	//batched read_val
+	int (*queue_ch)(struct i2c_batch*, int, unsigned, __u16[8]);	//a subset
+	const char *title;			//text layout, see render.h
+	char *unit_name[8];
+	int nch;					//channels output
+	int bits;					//channels are the bits of val[0]
 	__u16 val[8];
-	float lsb;
-	float conv_param[8];
+	float lsb;					//0: no unit (bits)
+	float conv_param[8];		//per channel gain
+	float conv_offset[8];
+	__u16 code_mask;			//0: all bits
+	int code_signed;
+	struct conv_tab conv;		//built from the above by conv_devices()
 };
 
 struct device hv_dev_list[4] = {
 	{.name      = "ads7828",
+	 .id        = BINLOG_ADS7828,
 	 .data_type = {"IHVp","IHVn","VHVn","VHVp","VHVs","Vpwr","Vset","Ilim"}, 
 	 .addr_low  = 0x48,
 	 .addr_high = 0x4b,
 	 .read_val  = ads7828_read_all, 
-	 .print_val = ads7828_print_val, 
+	 .queue_val = ads7828_queue_all, 
+	 .queue_ch  = ads7828_queue_ch, 
+	 .title     = "-----ADC------",
+	 .unit_name = {"uA","uA","kV","kV","nA","V","kV","uA"},
+	 .nch       = 8,
 	 .lsb = 4.53/4096, 
 	 .conv_param = {2, 2, 2, 2, 400, 1, 2, 2}, }, //unit conversion parameters 
 	{.name      = "ad5694",
+	 .id        = BINLOG_AD5694,
 	 .data_type = {"Vset","Ilim","DAC2","DAC3","DAC4","DAC5","DAC6","DAC7"},
 	 .addr_low  = 0x0c,
 	 .addr_high = 0x0f,
 	 .read_val  = ad5694_read_all, 
-	 .print_val = ad5694_print_val, 
+	 .queue_val = ad5694_queue_all, 
+	 .queue_ch  = ad5694_queue_ch, 
+	 .title     = "-----DAC------",
+	 .unit_name = {"kV","uA"},
+	 .nch       = 2,
 	 .lsb = 4.53/4096, 
 	 .conv_param = {2, 2, 1, 1, 1, 1, 1, 1}, }, //unit conversion parameters
     {.name      = "mcp23009",
+	 .id        = BINLOG_MCP23009,
 	 .data_type = {"D0  ","D1  ","D2  ","HVon","D4  ","D5  ","D6  ","D7  "},
 	 .addr_low  = 0x20,
 	 .addr_high = 0x27,
+	 .setup_val = mcp23009_setup, 
 	 .read_val  = mcp23009_read_val2, 
-	 .print_val = mcp23009_print_val, },
+	 .queue_val = mcp23009_queue_val2, 
+	 .title     = "------IO------",
+	 .nch       = 5,
+	 .bits      = 1, },
 	{.name = ""}
 };
 
 struct device sensors_dev_list[4] = {
 	{.name = "tmp75",
+	 .id = BINLOG_TMP75,
 	 .data_type = {"TMP"},
 	 .addr_low = 0x48,
 	 .addr_high = 0x4f,
 	 .read_val = tmp75_temp,
-	 .print_val = tmp75_print_val, },
+	 .queue_val = tmp75_queue_temp,
+	 .unit_name = {"C"},
+	 .nch = 1,
+	 .lsb = 1.0/256,		//12 bit left aligned, 0.0625 C
+	 .conv_param = {1},
+	 .code_signed = 1, },
 	{.name = "sht21",
+	 .id = BINLOG_SHT21,
 	 .data_type = {"HMD"},
 	 .addr_low = 0x40,		//single address
 	 .addr_high = 0x40,
 	 .read_val = sht21_humid,
-	 .print_val = sht21_print_val,}, 
+	 .step_val = sht21_humid_step,
+	 .unit_name = {"%"},
+	 .nch = 1,
+	 .lsb = 125.0/65536,	//RH = -6 + 125 * SRH / 2^16
+	 .conv_param = {1},
+	 .conv_offset = {-6},
+	 .code_mask = 0xfffc,},	//status bits
 	{.name = "mpl115",
+	 .id = BINLOG_MPL115,
 	 .data_type = {"PRS"},
 	 .addr_low = 0x60,		//single address
 	 .addr_high = 0x60,
 	 .read_val = mpl115_press,
-	 .print_val = mpl115_print_val,},
+	 .step_val = mpl115_press_step,
+	 .unit_name = {"kPa"},
+	 .nch = 1,
+	 .lsb = 1.0/16,			//kPa, 4 fractional bits
+	 .conv_param = {1},},
 	{.name = ""}
 };
 
+/* A device line of the config: a device at a known address, not probed.
+   period 0 samples it every cycle, ch_mask 0 keeps all its channels. */
+struct i2c_node_conf{
+	struct device *dev;
+	int addr;
+	char name[16];
+	double period;
+	unsigned ch_mask;
+};
+
+/* One discovered address of a device on a child bus. busy is set when
+   the address is claimed by a kernel driver (EBUSY), it is kept so the
+   output keeps its "0" placeholder for it. due is set for the cycles the
+   node is sampled in, next is its following deadline (CLOCK_MONOTONIC),
+   period_ns 0 takes the -d period. */
+struct i2c_node{
+	struct device *dev;
+	int addr;
+	int busy;
+	char name[16];
+	long long period_ns;
+	unsigned ch_mask;
+	int due;
+	struct timespec next;
+	unsigned long samples;
+	unsigned long miss;			//deadlines skipped, the bus was late
+	long long late_max;			//ns, worst start after the deadline
+	__u16 val[8];
+	float unit[8];
+	struct i2c_task task;
+};
+
 struct i2c_child_bus{
 	char type[16];
 	int bus_num;
+	int adapter;			//i2c-N, -1 ends the list
+	int parent;				//physical controller of the adapter
 	struct device *device_list;
+	struct i2c_node_conf conf[NODE_N_MAX];	//explicit devices, if any
+	int conf_n;
+	int fd;
+	int pfd;				//parent adapter, -P: batch goes direct
+	struct i2c_node node[NODE_N_MAX];
+	int node_n;
+	struct i2c_batch batch;
+	struct i2c_task batch_task;
 };
 
+static volatile sig_atomic_t stop = 0;
+
+static void stop_handler(int sig){
+	stop = 1;
+}
+
 static void help(void){
 	printf("Usage:\n"
 "     tool -HV (or -sensors)                  *display HV (sensors) values*\n"
 "     tool -l                                 *print all values to log*\n"
 "     tool -l -HV (or -sensors)               *print respective values to log*\n"
+"     tool -b [-HV (or -sensors)]             *log the raw codes, binary*\n"
+"     tool -B FILE                            *print a binary log as text*\n"
+"     tool [-HV] -q COL[@ADAPTER] FROM TO     *min/max/mean/percentiles of\n"
+"                                              a binary log column, times as\n"
+"                                              YYYY-MM-DD[THH:MM[:SS]]*\n"
+"     tool -d PERIOD [-l] [-HV (or -sensors)] *sample every PERIOD seconds,\n"
+"                                              or at the config periods*\n"
+"     tool -r ...                             *rescan busses, ignore cache*\n"
+"     tool -P ...                             *batched reads through the\n"
+"                                              parent adapter, mux channel\n"
+"                                              selected per transfer*\n"
+"     tool -g LINES ...                       *log lines per disk write,\n"
+"                                              -d default 64, else 1*\n"
+"     tool -F none|commit|close ...           *log fsync policy*\n"
+"     tool -f text|log|csv|json|influx ...    *output (or -B) format*\n"
 "     tool -Vset (Ilim) VAL                   *write VAL to Vset (Ilim)*\n"
+"     tool -Vset VAL -Ilim VAL                *both, staged on every board\n"
+"                                              and updated at once*\n"
 "     tool -on (-off)                         *turn HV on (off)*\n"
 "     tool -v                                 *tool software version*\n"
 "     tool -h                                 *help menu*\n");
 
 }
 
-int setup_mux_child_bus(int ch){
+int setup_child_bus(int adapter){
 
-	char filename[20];
 	int fd;
-	if(ch<0 || ch>8){
-		printf("Error: wrong mux child bus number");
-		return EXIT_FAILURE;
+	if(adapter<0 || adapter>9){
+		printf("Error: wrong bus (adapter) number");
+		return -1;
 	}
 
-   	snprintf(filename, 19, "/dev/i2c-%d", ch+1);
-   	
-	if((fd = open(filename, O_RDWR)) < 0){
+	if((fd = i2c_bus_open(adapter)) < 0){
 		printf("Failed to open the bus (adapter); %s\n", strerror(errno));
 		
-		return EXIT_FAILURE;
+		return -1;
 	}
 	return fd;
 }
@@ -146,6 +266,1006 @@ __u16 vset_ilim_to_ad5694(float val){	//val can be: vset in kV or ilim in uA
 	val = val/2; 						//division by 2 is to convert units
 	return (__u16) (val/LSB + 0.5);		//float to int rounding conversion;
 }
+/*Channel of dev named name (len chars), -1 if none*/
+int device_channel(struct device *dev, const char *name, size_t len){
+	const char *type;
+	int c;
+	for(c=0; c<8; c++){
+		type = dev->data_type[c];
+		if(type && !strncasecmp(type, name, len) && 
+						(type[len] == '\0' || type[len] == ' '))
+			return c;
+	}
+	return -1;
+}
+/*
+***************CONFIG***************
+*
+* Fills subsystem[] from the config file, the list is terminated by 
+* adapter == -1. busN lines are the mux child busses (i2c-N+1), i2cN 
+* lines name an adapter directly, e.g. the second controller i2c-0:
+*
+*	bus8=hv
+*
+* A bus has its whole address ranges probed unless it has device lines,
+* then only the devices listed are read, at the addresses given:
+*
+*	bus8.ads7828@0x49 name=hv1 period=0.01 ch=IHVp,IHVn,VHVp
+*
+* name, period (seconds, -d) and ch (a subset of the channels) are 
+* optional. Returns the number of child busses or -1 on error.
+*/
+static int config_adapter(const char *key, size_t len, int *bus_num){
+	char *end;
+	long n;
+
+	if(len < 4)
+		return -1;
+	n = strtol(key+3, &end, 10);
+	if(end != key+len || n < 0 || n > 9)
+		return -1;
+	if(!strncasecmp(key, "bus", 3)){
+		*bus_num = n;
+		return n+1;
+	}
+	if(!strncasecmp(key, "i2c", 3)){
+		*bus_num = n-1;
+		return n;
+	}
+	return -1;
+}
+
+static int config_node(struct i2c_child_bus subsystem[], int subsys_n,
+											char *line, const char *err){
+	struct i2c_child_bus *sub = NULL;
+	struct i2c_node_conf *conf;
+	struct device *dev;
+	char *save; char *tok; char *dot; char *at; char *end;
+	int adapter; int bus_num; int m; int ch;
+
+	tok = strtok_r(line, " \t", &save);
+	dot = strchr(tok, '.');
+	at = strchr(tok, '@');
+	if(dot == NULL || at == NULL || at < dot || 
+			(adapter = config_adapter(tok, dot - tok, &bus_num)) < 0){
+		fprintf(stderr, "%s %s is not busN.DEVICE@ADDR\n", err, tok);
+		return -1;
+	}
+	for(m=0; m<subsys_n; m++){
+		if(subsystem[m].adapter == adapter)
+			sub = &subsystem[m];
+	}
+	if(sub == NULL){
+		fprintf(stderr, "%s %.*s has no bus line above\n", err, 
+													(int)(dot - tok), tok);
+		return -1;
+	}
+	*at = '\0';
+	for(dev=sub->device_list; dev->name[0] != '\0'; dev++){
+		if(!strcasecmp(dev->name, dot+1))
+			break;
+	}
+	if(dev->name[0] == '\0'){
+		fprintf(stderr, "%s no %s on a %s bus\n", err, dot+1, sub->type);
+		return -1;
+	}
+	if(sub->conf_n == NODE_N_MAX){
+		fprintf(stderr, "%s too many devices\n", err);
+		return -1;
+	}
+	conf = &sub->conf[sub->conf_n];
+	memset(conf, 0, sizeof(*conf));
+	conf->dev = dev;
+	conf->addr = strtol(at+1, &end, 0);
+	if(*end != '\0' || conf->addr < 0x03 || conf->addr > 0x77){
+		fprintf(stderr, "%s %s is not an address\n", err, at+1);
+		return -1;
+	}
+
+	while((tok = strtok_r(NULL, " \t", &save)) != NULL){
+		if(!strncasecmp(tok, "name=", 5) && strlen(tok+5) > 0 &&
+									strlen(tok+5) < sizeof(conf->name)){
+			strcpy(conf->name, tok+5);
+		}
+		else if(!strncasecmp(tok, "period=", 7) && 
+									(conf->period = atof(tok+7)) > 0){
+			continue;
+		}
+		else if(!strncasecmp(tok, "ch=", 3)){
+			for(tok+=3; *tok; tok+=strcspn(tok, ","), tok+=(*tok == ',')){
+				ch = device_channel(dev, tok, strcspn(tok, ","));
+				if(ch < 0 || ch >= dev->nch){
+					fprintf(stderr, "%s %s has no channel %.*s\n", err, 
+								dev->name, (int)strcspn(tok, ","), tok);
+					return -1;
+				}
+				conf->ch_mask |= 1u << ch;
+			}
+		}
+		else{
+			fprintf(stderr, "%s bad option %s\n", err, tok);
+			return -1;
+		}
+	}
+	sub->conf_n++;
+	return 0;
+}
+
+int read_config(const char *path, struct i2c_child_bus subsystem[]){
+	FILE *fp_conf;
+	char line[CONFIG_FILE_LINE_MAX];
+	char err[CONFIG_FILE_LINE_MAX];
+	int subsys_n=0; int lnum=0;
+	int ret = -1;
+
+	if((fp_conf = fopen(path, "r")) == NULL){
+		fprintf(stderr, "Error: can't open %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+	
+	while(fgets(line, sizeof(line), fp_conf) != NULL){
+		char *p; char *q;
+		lnum++;
+		snprintf(err, sizeof(err), "Error in %s line %d:", path, lnum);
+		if(strchr(line, '\n') == NULL && !feof(fp_conf)){
+			fprintf(stderr, "%s line too long\n", err);
+			goto OUT;
+		}
+		line[strcspn(line, "#\r\n")] = '\0';
+		p = line + strspn(line, " \t");
+		if(*p == '\0')
+			continue;
+		if(strchr(p, '@')){			//device line
+			if(config_node(subsystem, subsys_n, p, err) < 0)
+				goto OUT;
+			continue;
+		}
+
+		for(q=p; *p; p++){			//busN=type, blanks ignored
+			if(*p != ' ' && *p != '\t')
+				*q++ = *p;
+		}
+		*q = '\0';
+		p = line + strspn(line, " \t");
+
+		char *token_frst; char *token_scnd;
+		struct device *tmp_dev_list;
+		int tmp_bus_num; int tmp_adapter;
+		token_frst = strtok(p, "=");
+		token_scnd = strtok(NULL, "");
+		if((tmp_adapter = config_adapter(token_frst, strlen(token_frst), 
+													&tmp_bus_num)) < 0){
+			fprintf(stderr, "%s %s not an bus\n", err, token_frst);
+			goto OUT;
+		}
+		if(token_scnd == NULL)
+			token_scnd = "";
+		if(!strcasecmp(token_scnd, "hv"))
+			tmp_dev_list = hv_dev_list;
+		else if(!strcasecmp(token_scnd, "sensors"))
+			tmp_dev_list = sensors_dev_list;
+		else{
+			fprintf(stderr, "%s %s not a bus option\n", err, token_scnd);
+			goto OUT;
+		}
+		if(subsys_n>=SUBSYS_N_MAX){
+			fprintf(stderr, "%s too much busses\n", err);
+			goto OUT;
+		}
+		strcpy(subsystem[subsys_n].type, tmp_dev_list == hv_dev_list ? 
+														"hv" : "sensors");
+		subsystem[subsys_n].bus_num = tmp_bus_num;
+		subsystem[subsys_n].adapter = tmp_adapter;
+		subsystem[subsys_n].parent = tmp_adapter;
+		subsystem[subsys_n].device_list = tmp_dev_list;
+		subsystem[subsys_n].conf_n = 0;
+		subsystem[subsys_n].fd = -1;
+		subsystem[subsys_n].pfd = -1;
+		subsystem[subsys_n].node_n = 0;
+		subsys_n++;
+	}
+	ret = subsys_n;
+OUT:
+	subsystem[subsys_n].adapter = -1; 
+	fclose(fp_conf);
+	return ret;
+}
+/*
+***************SCAN*****************
+*
+* Finds the addresses of every device of the child bus, through the 
+* discovery cache, and keeps them. Done once, the acquisition loop only 
+* walks sub->node[]. A bus with device lines in the config is not 
+* probed, its nodes are the devices listed.
+*/
+static struct i2c_node *add_node(struct i2c_child_bus *sub, 
+								struct device *dev, int addr, int busy){
+	struct i2c_node *node = &sub->node[sub->node_n++];
+
+	memset(node, 0, sizeof(*node));
+	node->dev = dev;
+	node->addr = addr;
+	node->busy = busy;
+	return node;
+}
+
+int scan_child_bus(struct i2c_child_bus *sub, struct i2c_cache *cache, 
+															const char *only){
+	int n; int j; int found;
+	int list[NODE_N_MAX+1];
+	int addr[NODE_N_MAX]; int busy[NODE_N_MAX];
+	struct device *dev;
+
+	sub->node_n = 0;
+	for(n=0; n<sub->conf_n; n++){
+		struct i2c_node_conf *conf = &sub->conf[n];
+		struct i2c_node *node;
+		if(only && strcmp(conf->dev->name, only))
+			continue;
+		node = add_node(sub, conf->dev, conf->addr, 0);
+		strcpy(node->name, conf->name);
+		node->period_ns = llround(conf->period * 1e9);
+		node->ch_mask = conf->ch_mask;
+	}
+	if(sub->conf_n)
+		return sub->node_n;
+
+	for(n=0; sub->device_list[n].name[0]!='\0'; n++){
+		dev = &sub->device_list[n];
+		if(only && strcmp(dev->name, only))
+			continue;
+
+		i2c_range_list(list, dev->addr_low, dev->addr_high);
+		found = i2c_cache_find(cache, sub->fd, sub->adapter, dev->name, list,
+									addr, busy, NODE_N_MAX - sub->node_n);
+		if(found < 0)
+			return -1;
+
+		for(j=0; j<found; j++)
+			add_node(sub, dev, addr[j], busy[j]);
+	}
+	return sub->node_n;
+}
+
+/*
+* Devices with a setup_val are configured once here, through the kernel
+* mux: with -P the batched reads go to the parent adapter, the mux 
+* deselected, where only a transfer with its own select can reach them.
+*/
+void setup_child_nodes(struct i2c_child_bus *sub){
+	struct i2c_node *node;
+	int k;
+
+	for(k=0; k<sub->node_n; k++){
+		node = &sub->node[k];
+		if(node->busy || !node->dev->setup_val)
+			continue;
+		if(node->dev->setup_val(sub->fd, node->addr) < 0)
+			fprintf(stderr, "Warning: can't set up %s 0x%02x on i2c-%d; %s\n",
+					node->dev->name, node->addr, sub->adapter, strerror(errno));
+	}
+}
+/*
+***************LOG******************
+*
+* Lines go through a logwr (logwr.c): formatted in memory and committed
+* a group at a time, the file is rotated at midnight by the writer.
+*/
+void open_log(struct logwr *lw, int hv, int sensors, const char *ext, 
+												int group, int fsync_policy){
+	const char *prefix = hv ? "hv" : sensors ? "sensors" : "";
+
+	logwr_init(lw, prefix, ext, group, fsync_policy);
+	if(!strcmp(ext, "bin"))
+		lw->rec_size = BINLOG_REC_SIZE;
+}
+
+/*
+***************SAMPLE***************
+*
+* Every node found by scan_child_bus() becomes a task. Devices with a 
+* conversion time (step_val) go first, so their conversions are started
+* before anything else, then the devices that can be batched are read 
+* with as few I2C_RDWR transfers as the kernel allows and the others one
+* by one. The scheduler comes back to the conversions when they are due,
+* so a cycle costs about the longest conversion instead of their sum.
+* The busses of a worker are queued one after the other and the 
+* scheduler stays on a bus while it has work ready (i2c_task.c): behind
+* a mux, the work of a channel is done in one stretch, one select.
+* Nodes not due this cycle (config period) are left out, so are the 
+* channels out of a node's ch_mask for the devices that can skip them.
+*/
+int read_node_step(struct i2c_task *t){
+	struct i2c_node *node = t->arg;
+	if(node->dev->read_val(t->fd, t->addr, node->val) != 0)
+		return -1;
+	return I2C_TASK_DONE;
+}
+
+int read_batch_step(struct i2c_task *t){
+	struct i2c_child_bus *sub = t->arg;
+	struct i2c_node *node;
+	int k;
+
+	for(k=0; k<sub->node_n; k++){
+		node = &sub->node[k];
+		if(node->busy || !node->due)
+			continue;
+		if(node->ch_mask && node->dev->queue_ch)
+			node->dev->queue_ch(&sub->batch, node->addr, node->ch_mask, 
+																node->val);
+		else if(node->dev->queue_val)
+			node->dev->queue_val(&sub->batch, node->addr, node->val);
+	}
+	return i2c_batch_flush(&sub->batch) < 0 ? -1 : I2C_TASK_DONE;
+}
+
+/*Appends the tasks of sub to task[], pass 0 conversions, 1 the rest*/
+int queue_child_bus(struct i2c_child_bus *sub, int pass, 
+											struct i2c_task *task[], int n){
+	int k; int batched = 0;
+	struct i2c_node *node;
+
+	for(k=0; k<sub->node_n; k++){
+		node = &sub->node[k];
+		if(node->busy || !node->due ||
+						(pass == 0) != (node->dev->step_val != NULL))
+			continue;
+		if(node->dev->step_val){
+			i2c_task_init(&node->task, node->dev->step_val, sub->fd, 
+													node->addr, node->val);
+		}
+		else if(node->dev->queue_val){
+			batched++;
+			continue;
+		}
+		else{
+			i2c_task_init(&node->task, read_node_step, sub->fd, 
+													node->addr, node->val);
+			node->task.arg = node;
+		}
+		task[n++] = &node->task;
+	}
+
+	if(batched){
+		i2c_task_init(&sub->batch_task, read_batch_step, sub->fd, 0, NULL);
+		sub->batch_task.arg = sub;
+		sub->batch_task.direct = sub->batch.mux_addr != 0;	//-P
+		task[n++] = &sub->batch_task;
+	}
+	return n;
+}
+
+/*Converts the codes of the last bus_worker_run() to units, see conv.h*/
+void conv_child_bus(struct i2c_child_bus *sub){
+	int k;
+	struct i2c_node *node;
+
+	for(k=0; k<sub->node_n; k++){
+		node = &sub->node[k];
+		conv_snapshot(&node->dev->conv, node->val, node->unit);
+	}
+}
+
+void render_device(struct render_item *it, struct device *dev, int adapter,
+				int inst, int busy, const __u16 *val, const float *unit){
+	it->dev = dev->name;
+	it->title = dev->title;
+	it->data_type = dev->data_type;
+	it->unit_name = dev->unit_name;
+	it->nch = dev->nch;
+	it->bits = dev->bits;
+	it->adapter = adapter;
+	it->inst = inst;
+	it->name = NULL;
+	it->ch_mask = 0;
+	it->busy = busy;
+	it->held = 0;
+	it->val = val;
+	it->unit = unit;
+}
+
+/*Render items of the last conv_child_bus(), output order*/
+int render_child_bus(struct i2c_child_bus *sub, struct render_item *it){
+	int k; int i=0;
+	struct device *dev;
+	struct device *prev = NULL;
+	struct i2c_node *node;
+
+	for(k=0; k<sub->node_n; k++){
+		node = &sub->node[k];
+		dev = node->dev;
+		if(dev != prev){		//instance counter restarts for each device
+			i = 0;
+			prev = dev;
+		}
+		render_device(&it[k], dev, sub->adapter, i++, node->busy, 
+													node->val, node->unit);
+		if(node->name[0])
+			it[k].name = node->name;
+		it[k].ch_mask = node->ch_mask;
+		it[k].held = !node->due;
+	}
+	return sub->node_n;
+}
+/*Binary log records of the last bus_worker_run(), raw codes only, the
+  nodes not due have no record*/
+int binlog_child_bus(struct i2c_child_bus *sub, struct binlog_rec *rec, 
+															__u64 ts){
+	int k; int i=0; int n=0;
+	struct device *prev = NULL;
+	struct i2c_node *node;
+
+	for(k=0; k<sub->node_n; k++, i++){
+		node = &sub->node[k];
+		if(node->dev != prev){
+			i = 0;
+			prev = node->dev;
+		}
+		if(!node->due)
+			continue;
+		binlog_fill(&rec[n++], node->dev->id, i, sub->adapter, 
+						node->addr | (node->busy ? BINLOG_BUSY : 0), ts,
+						node->busy ? NULL : node->val);
+	}
+	return n;
+}
+
+struct device *find_device(int id){
+	struct device *list[2] = {hv_dev_list, sensors_dev_list};
+	int l; int n;
+	for(l=0; l<2; l++){
+		for(n=0; list[l][n].name[0] != '\0'; n++){
+			if(list[l][n].id == id)
+				return &list[l][n];
+		}
+	}
+	return NULL;
+}
+
+/*Vector conversion tables of every device descriptor*/
+void conv_devices(void){
+	struct device *list[2] = {hv_dev_list, sensors_dev_list};
+	struct device *dev;
+	int l; int n;
+	for(l=0; l<2; l++){
+		for(n=0; list[l][n].name[0] != '\0'; n++){
+			dev = &list[l][n];
+			conv_init(&dev->conv, dev->lsb, dev->conv_param, 
+						dev->conv_offset, dev->code_mask, dev->code_signed);
+		}
+	}
+}
+
+/*
+* Renders a cycle straight into the line in progress of the writer. A 
+* cycle larger than the buffer is committed as it goes.
+*/
+void render_log(struct logwr *lw, int fmt, struct timespec *ts, 
+									struct render_item *it, int n){
+	char *buf;
+	size_t room;
+	int k = 0;
+
+	while(1){
+		buf = logwr_reserve(lw, &room);
+		logwr_advance(lw, render_cycle(fmt, ts, it, n, &k, buf, room));
+		if(k >= n || logwr_flush_partial(lw) < 0)
+			break;
+	}
+}
+
+/*Prints a binary log in format fmt, one output cycle per sample cycle*/
+int dump_binlog(const char *path, int fmt){
+	static struct binlog_rec cyc[SUBSYS_N_MAX*NODE_N_MAX];
+	static float unit[SUBSYS_N_MAX*NODE_N_MAX][8];
+	static struct render_item it[SUBSYS_N_MAX*NODE_N_MAX];
+	static struct logwr out;
+	static struct binlog_rec buf[256];
+	struct binlog_rec rec;
+	struct device *dev;
+	struct timespec ts;
+	int fd; int n; int k; int cyc_n = 0;
+	int buf_n = 0; int buf_k = 0;
+	long bad = 0;
+
+	if((fd = open(path, O_RDONLY)) < 0){
+		fprintf(stderr, "Error: can't open %s; %s\n", path, strerror(errno));
+		return -1;
+	}
+	logwr_init_fd(&out, STDOUT_FILENO, LOGWR_GROUP);
+	if(fmt == RENDER_CSV)
+		write(STDOUT_FILENO, RENDER_CSV_HEADER, strlen(RENDER_CSV_HEADER));
+	do{
+		if(buf_k == buf_n){
+			buf_n = binlog_read(fd, buf, 256);
+			buf_k = 0;
+		}
+		if((n = buf_n) > 0)
+			rec = buf[buf_k++];
+		if(cyc_n && (n <= 0 || rec.ts != cyc[0].ts || 
+												cyc_n == SUBSYS_N_MAX*NODE_N_MAX)){
+			for(k=0; k<cyc_n; k++){		//the whole cycle at once
+				dev = find_device(cyc[k].dev);
+				conv_snapshot(&dev->conv, cyc[k].val, unit[k]);
+				render_device(&it[k], dev, cyc[k].adapter, cyc[k].inst,
+						cyc[k].addr & BINLOG_BUSY, cyc[k].val, unit[k]);
+			}
+			ts.tv_sec = cyc[0].ts / 1000000000ULL;
+			ts.tv_nsec = cyc[0].ts % 1000000000ULL;
+			logwr_line_start(&out, ts.tv_sec);
+			render_log(&out, fmt, &ts, it, cyc_n);
+			logwr_line_end(&out);
+			cyc_n = 0;
+		}
+		if(n <= 0)
+			break;
+		if(!binlog_check(&rec) || !find_device(rec.dev)){
+			bad++;
+			continue;
+		}
+		cyc[cyc_n++] = rec;
+	}while(1);
+	logwr_close(&out);
+	close(fd);
+	if(bad)
+		fprintf(stderr, "%s: %ld corrupt records skipped\n", path, bad);
+	return n < 0 ? -1 : 0;
+}
+/*
+***************QUERY****************
+*
+* Aggregates of one column of the binary logs over a time range, see
+* query.c. COLUMN is a data_type name (IHVp, TMP, ...) optionally 
+* followed by @N to keep only adapter i2c-N, the times are local 
+* YYYY-MM-DD[THH:MM[:SS]], a date alone meaning the whole day.
+*/
+int parse_time(const char *str, int end, time_t *t){
+	struct tm tm;
+	int n;
+
+	memset(&tm, 0, sizeof(tm));
+	n = sscanf(str, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, 
+							&tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+	if(n < 3 || n == 4){
+		fprintf(stderr, "Error: %s is not YYYY-MM-DD[THH:MM[:SS]]\n", str);
+		return -1;
+	}
+	if(n == 3 && end){
+		tm.tm_hour = 23;
+		tm.tm_min = 59;
+		tm.tm_sec = 59;
+	}
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+	*t = mktime(&tm);
+	return 0;
+}
+
+struct device *find_column(const char *name, size_t len, int *ch){
+	struct device *list[2] = {hv_dev_list, sensors_dev_list};
+	int l; int n;
+
+	for(l=0; l<2; l++){
+		for(n=0; list[l][n].name[0] != '\0'; n++){
+			if((*ch = device_channel(&list[l][n], name, len)) >= 0)
+				return &list[l][n];
+		}
+	}
+	return NULL;
+}
+
+int query_log(const char *column, const char *from, const char *to,
+														const char *prefix){
+	static struct query q;
+	struct query_grp *g;
+	struct device *dev;
+	const char *at = strchr(column, '@');
+	struct conv_tab *c;
+	int i; int ch;
+
+	dev = find_column(column, at ? (size_t)(at - column) : strlen(column), 
+																		&ch);
+	if(dev == NULL || dev->lsb == 0){
+		fprintf(stderr, "Error: %s is not a logged value\n", column);
+		return -1;
+	}
+	if(parse_time(from, 0, &q.from) < 0 || parse_time(to, 1, &q.to) < 0)
+		return -1;
+	q.prefix = prefix;
+	q.dev = dev->id;
+	q.ch = ch;
+	q.adapter = at ? atoi(at+1) : QUERY_ANY;
+	q.code_signed = dev->code_signed;
+	if(query_run(&q) < 0)
+		return -1;
+
+	c = &dev->conv;
+	for(i=0; i<q.grp_n; i++){
+		g = &q.grp[i];
+		printf("%s i2c-%d %s#%d: n %llu min %0.3f max %0.3f mean %0.3f "
+				"p50 %0.3f p90 %0.3f p99 %0.3f\n", dev->data_type[ch], 
+			g->adapter, dev->name, g->inst, (unsigned long long)g->n,
+			conv_unit(c, ch, query_code(&q, g->min[ch])),
+			conv_unit(c, ch, query_code(&q, g->max[ch])),
+			conv_unit(c, ch, query_code(&q, (double)g->sum[ch]/g->n)),
+			conv_unit(c, ch, query_percentile(&q, g, 50)),
+			conv_unit(c, ch, query_percentile(&q, g, 90)),
+			conv_unit(c, ch, query_percentile(&q, g, 99)));
+	}
+	if(q.grp_n == 0)
+		printf("%s: no samples\n", column);
+	if(q.bad)
+		fprintf(stderr, "%ld corrupt records skipped\n", q.bad);
+	query_free(&q);
+	return 0;
+}
+/*
+***************WORKERS**************
+*
+* One worker per physical controller: the child busses of a mux share 
+* the parent wires and are read in turn by the same worker, busses on 
+* different controllers are read at the same time.
+*/
+struct bus_worker{
+	pthread_t thread;
+	int parent;
+	struct i2c_child_bus *sub[SUBSYS_N_MAX];
+	int sub_n;
+	int joinable;
+	struct i2c_task *task[SUBSYS_N_MAX*(NODE_N_MAX+1)];
+	struct i2c_task_bus bus;	//mux channel left selected, selects
+	unsigned long cycles;
+};
+
+void *bus_worker_run(void *arg){
+	struct bus_worker *w = arg;
+	int k; int n = 0;
+	for(k=0; k<w->sub_n; k++){	//a bus, conversions first, then the next
+		n = queue_child_bus(w->sub[k], 0, w->task, n);
+		n = queue_child_bus(w->sub[k], 1, w->task, n);
+	}
+	i2c_task_run_bus(w->task, n, &w->bus);
+	w->cycles++;
+	return NULL;
+}
+
+/*
+* Mux writes per cycle of each controller, the same count with both 
+* transports: a kernel select per change of child bus, a select and a
+* deselect per I2C_RDWR of the -P batches.
+*/
+void report_workers(struct bus_worker worker[], int worker_n){
+	unsigned long direct; unsigned long total;
+	int w; int k;
+
+	for(w=0; w<worker_n; w++){
+		for(k=0, direct=0; k<worker[w].sub_n; k++)
+			direct += worker[w].sub[k]->batch.mux_writes;
+		total = worker[w].bus.switches + direct;
+		fprintf(stderr, "i2c-%d: %d busses, %lu cycles, %lu mux writes "
+				"(%lu kernel selects, %lu in transfers), %0.2f per cycle\n",
+				worker[w].parent, worker[w].sub_n, worker[w].cycles, total,
+				worker[w].bus.switches, direct, worker[w].cycles ?
+				(double)total/worker[w].cycles : 0);
+	}
+}
+
+int group_workers(struct i2c_child_bus subsystem[], struct bus_worker worker[]){
+	int m; int w; int worker_n = 0;
+
+	for(m=0; subsystem[m].adapter != -1; m++){
+		if(subsystem[m].fd < 0)
+			continue;
+		for(w=0; w<worker_n; w++){
+			if(worker[w].parent == subsystem[m].parent)
+				break;
+		}
+		if(w == worker_n){
+			worker[w].parent = subsystem[m].parent;
+			worker[w].sub_n = 0;
+			worker[w].bus.last_fd = -1;
+			worker[w].bus.switches = 0;
+			worker[w].cycles = 0;
+			worker_n++;
+		}
+		worker[w].sub[worker[w].sub_n++] = &subsystem[m];
+	}
+	return worker_n;
+}
+
+void read_workers(struct bus_worker worker[], int worker_n){
+	int w;
+
+	if(worker_n == 1){			//nothing to overlap with
+		bus_worker_run(&worker[0]);
+		return;
+	}
+	for(w=0; w<worker_n; w++){
+		worker[w].joinable = !pthread_create(&worker[w].thread, NULL, 
+												bus_worker_run, &worker[w]);
+		if(!worker[w].joinable)
+			bus_worker_run(&worker[w]);
+	}
+	for(w=0; w<worker_n; w++){
+		if(worker[w].joinable)
+			pthread_join(worker[w].thread, NULL);
+	}
+}
+
+static inline void timespec_add_ns(struct timespec *t, long long ns){
+	ns += t->tv_nsec;
+	t->tv_sec += ns / 1000000000LL;
+	t->tv_nsec = ns % 1000000000LL;
+}
+
+static inline long long timespec_diff_ns(struct timespec *a, 
+														struct timespec *b){
+	return (a->tv_sec - b->tv_sec) * 1000000000LL + 
+											(a->tv_nsec - b->tv_nsec);
+}
+
+static inline int timespec_before(struct timespec *a, struct timespec *b){
+	return a->tv_sec < b->tv_sec || 
+			(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+***************SCHEDULE*************
+*
+* Every node has its own period (config period=, else -d) on an absolute
+* grid: its deadlines are the first sample plus whole periods, counted in
+* integer ns, so rates don't drift whatever the cycle length. The loop 
+* sleeps with TIMER_ABSTIME to the earliest deadline of all the nodes and
+* samples the nodes due then. A node whose bus was still busy past a 
+* whole period skips it: that is a deadline miss. late_max bounds the 
+* timestamp jitter of the node.
+*/
+void due_child_bus(struct i2c_child_bus *sub, struct timespec *now, 
+														long long period_ns){
+	int k;
+	long long p; long long late;
+	struct i2c_node *node;
+
+	for(k=0; k<sub->node_n; k++){
+		node = &sub->node[k];
+		p = node->period_ns > 0 ? node->period_ns : period_ns;
+		if(p <= 0){				//one shot
+			node->due = 1;
+			continue;
+		}
+		if(node->next.tv_sec == 0 && node->next.tv_nsec == 0)
+			node->next = *now;
+		node->due = !timespec_before(now, &node->next);
+		if(!node->due)
+			continue;
+		node->samples++;
+		late = timespec_diff_ns(now, &node->next);
+		if(late > node->late_max)
+			node->late_max = late;
+		timespec_add_ns(&node->next, p);
+		if(!timespec_before(now, &node->next)){
+			node->miss += late / p;
+			timespec_add_ns(&node->next, late / p * p);
+		}
+	}
+}
+
+/*Earliest deadline of the nodes of sub, if before *t*/
+void deadline_child_bus(struct i2c_child_bus *sub, struct timespec *t){
+	int k;
+	for(k=0; k<sub->node_n; k++){
+		if(timespec_before(&sub->node[k].next, t))
+			*t = sub->node[k].next;
+	}
+}
+
+void report_child_bus(struct i2c_child_bus *sub, long long period_ns){
+	int k;
+	struct i2c_node *node;
+
+	for(k=0; k<sub->node_n; k++){
+		node = &sub->node[k];
+		fprintf(stderr, "i2c-%d %s@0x%02x%s%s: period %0.3f ms, %lu samples, "
+				"%lu deadline misses, max late %0.3f ms\n", sub->adapter, 
+				node->dev->name, node->addr, node->name[0] ? " " : "", 
+				node->name, (node->period_ns ? node->period_ns : period_ns)/1e6,
+				node->samples, node->miss, node->late_max/1e6);
+	}
+}
+/*
+***************BUSSES***************
+*
+* Opens and scans the busses of type (NULL: all), the daemon keeps them
+* open. On a config change they are closed and opened again from the 
+* new config. direct (-P) sends the batched reads of a mux channel 
+* through the parent adapter, the channel selected and deselected inside
+* each I2C_RDWR (i2c_batch_mux), instead of through the kernel mux.
+*/
+int direct_child_bus(struct i2c_child_bus *sub){
+	struct i2c_mux mux;
+
+	if(i2c_mux_find(sub->adapter, &mux) < 0)
+		return 0;				//not behind a mux, nothing to bypass
+	if(i2c_mux_check(&mux) < 0 || (sub->pfd = i2c_bus_open(mux.parent)) < 0)
+		return -1;
+	i2c_batch_init(&sub->batch, sub->pfd);
+	return i2c_batch_mux(&sub->batch, &mux);
+}
+
+int open_child_busses(struct i2c_child_bus subsystem[], 
+						struct i2c_cache *cache, const char *type, 
+							int rescan, const char *only, int direct){
+	int m;
+	int res = 0;
+
+	for(m=0; subsystem[m].adapter != -1; m++){
+		if(type && strcmp(subsystem[m].type, type))
+			continue;
+		if((subsystem[m].fd = setup_child_bus(subsystem[m].adapter)) < 0){
+			res = -1;
+			continue;
+		}
+		i2c_batch_init(&subsystem[m].batch, subsystem[m].fd);
+		if(direct && direct_child_bus(&subsystem[m]) < 0)
+			res = -1;
+		subsystem[m].parent = i2c_bus_parent(subsystem[m].adapter);
+		if(rescan)
+			i2c_cache_forget(cache, subsystem[m].adapter, NULL);
+		if(scan_child_bus(&subsystem[m], cache, only) < 0)
+			res = -1;
+		setup_child_nodes(&subsystem[m]);
+	}
+	i2c_cache_save(cache, I2C_CACHE_FILE);
+	return res;
+}
+
+void close_child_busses(struct i2c_child_bus subsystem[]){
+	int m;
+	for(m=0; subsystem[m].adapter != -1; m++){
+		if(subsystem[m].fd >= 0)
+			i2c_bus_close(subsystem[m].fd);
+		if(subsystem[m].pfd >= 0)
+			i2c_bus_close(subsystem[m].pfd);
+		subsystem[m].fd = -1;
+		subsystem[m].pfd = -1;
+	}
+}
+
+/*
+* Vset/Ilim of every HV board, staged then updated: the outputs of a 
+* board change together, the boards one update command apart. With -P 
+* and the boards behind one mux it is all one I2C_RDWR on the parent 
+* adapter, the channel selects in between. Otherwise each board is staged
+* in its own transfer and the updates follow back to back.
+*/
+static void dac_queue_stage(struct i2c_batch *b, int addr, unsigned mask,
+															const __u16 code[4]){
+	int ch;
+	ad5694_queue_ldac_mask(b, addr, 0x0f);
+	for(ch=0; ch<4; ch++){
+		if(mask & (1u << ch))
+			ad5694_queue_stage(b, addr, ch, code[ch]);
+	}
+}
+
+int dac_child_busses(struct i2c_child_bus subsystem[], unsigned mask,
+											const __u16 code[4], int direct){
+	static struct i2c_batch b;
+	static int board[SUBSYS_N_MAX*NODE_N_MAX][2];
+	struct i2c_mux mux[SUBSYS_N_MAX];
+	struct timespec t0; struct timespec t1;
+	int n = 0; int m; int k; int res = 0;
+	int first = -1;				//bus of the first board, its mux the one
+	int added;
+
+	for(m=0; subsystem[m].adapter != -1; m++){
+		for(k=0, added=0; k<subsystem[m].node_n; k++){
+			if(subsystem[m].node[k].busy)
+				continue;
+			board[n][0] = m;
+			board[n++][1] = k;
+			added++;
+		}
+		if(!direct || !added)
+			continue;
+		if(subsystem[m].pfd < 0 || 
+						i2c_mux_find(subsystem[m].adapter, &mux[m]) < 0)
+			direct = 0;
+		else if(first < 0)
+			first = m;
+		else if(mux[m].parent != mux[first].parent ||
+										mux[m].addr != mux[first].addr)
+			direct = 0;			//not one parent adapter
+	}
+	if(n == 0)
+		return 0;
+
+	if(direct){
+		i2c_batch_init(&b, subsystem[first].pfd);
+		for(k=0; k<n; k++){
+			m = board[k][0];
+			i2c_batch_write_byte(&b, mux[m].addr, I2C_MUX_SELECT|mux[m].chan);
+			dac_queue_stage(&b, subsystem[m].node[board[k][1]].addr, mask, 
+																	code);
+		}
+		for(k=0; k<n; k++){
+			m = board[k][0];
+			i2c_batch_write_byte(&b, mux[m].addr, I2C_MUX_SELECT|mux[m].chan);
+			ad5694_queue_update(&b, subsystem[m].node[board[k][1]].addr, mask);
+		}
+		i2c_batch_write_byte(&b, mux[first].addr, 0);
+		if(i2c_batch_msgs(&b) > I2C_RDWR_IOCTL_MAX_MSGS)
+			direct = 0;			//it would be split, the mux could move
+		else{
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			res = i2c_batch_flush(&b);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+		}
+	}
+	if(!direct){
+		for(k=0; k<n; k++){
+			m = board[k][0];
+			i2c_batch_init(&b, subsystem[m].fd);
+			dac_queue_stage(&b, subsystem[m].node[board[k][1]].addr, mask, 
+																	code);
+			if(i2c_batch_flush(&b) < 0)
+				res = -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for(k=0; k<n; k++){
+			m = board[k][0];
+			i2c_batch_init(&b, subsystem[m].fd);
+			ad5694_queue_update(&b, subsystem[m].node[board[k][1]].addr, mask);
+			if(i2c_batch_flush(&b) < 0)
+				res = -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+	}
+	fprintf(stderr, "setpoint: %d boards %s %0.3f ms\n", n, 
+				direct ? "in one transfer of" : "updated within", 
+				timespec_diff_ns(&t1, &t0)/1e6);
+	return res;
+}
+
+/*inotify on the config directory: editors replace the file (rename)*/
+int config_watch(const char *path){
+	char dir[128];
+	const char *slash = strrchr(path, '/');
+	int ifd;
+
+	snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) : 1,
+												slash ? path : ".");
+	if((ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		return -1;
+	if(inotify_add_watch(ifd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0){
+		fprintf(stderr, "Warning: can't watch %s; %s\n", dir, 
+														strerror(errno));
+		close(ifd);
+		return -1;
+	}
+	return ifd;
+}
+
+/*Drains the pending events, 1 if the config file was written or replaced*/
+int config_changed(int ifd, const char *path){
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	char *p;
+	ssize_t len;
+	int changed = 0;
+
+	while((len = read(ifd, buf, sizeof(buf))) > 0){
+		for(p=buf; p<buf+len; p+=sizeof(*ev)+ev->len){
+			ev = (const struct inotify_event*)p;
+			if(ev->len && !strcmp(ev->name, name))
+				changed = 1;
+		}
+	}
+	return changed;
+}
 /**********************************
 *                                 *
 *          MAIN                   *
@@ -154,8 +1274,14 @@ __u16 vset_ilim_to_ad5694(float val){	//val can be: vset in kV or ilim in uA
 int main(int argc, char *argv[]){
 	int flags=0;	int hlp = 0;	   int version = 0;
 	int log = 0;    int hv = 0;        int sensors = 0;
-	int dac = 0;    int hv_on = 0;     int hv_off = 0;
-	int dac_ch = 0; float dac_val = 0;
+	int dac = 0;    int hv_on = 0;     int hv_off = 0;	//dac: channel mask
+	float dac_val[4] = {0};
+	int daemon = 0; double period = 0; long long period_ns = 0;
+	int rescan = 0; int binary = 0; int direct = 0;
+	const char *dump = NULL;
+	char **query = NULL;
+	int group = 0; int fsync_policy = LOGWR_FSYNC_NONE;	//group 0: default
+	int fmt = -1;
 
 
 	while (1+flags < argc && argv[1+flags][0] == '-') {
@@ -167,16 +1293,75 @@ int main(int argc, char *argv[]){
 			case 'S': sensors = 1; break;
 			case 'v': version = 1; break;
 	        case 'V': 
-					dac = 1;
-					dac_ch = 0;
-					dac_val = atof(argv[2+flags]); 
+					if(2+flags >= argc){
+						help();
+						return EXIT_FAILURE;
+					}
+					dac |= 1;
+					dac_val[0] = atof(argv[2+flags]); 
+					flags++;
 					break;
             case 'I': 
-					dac = 1;
-					dac_ch = 1;
-					dac_val = atof(argv[2+flags]);
+					if(2+flags >= argc){
+						help();
+						return EXIT_FAILURE;
+					}
+					dac |= 2;
+					dac_val[1] = atof(argv[2+flags]);
+					flags++;
 					break;
             case 'l': log = 1; break;
+			case 'b': log = 1; binary = 1; break;
+			case 'B':
+					if(2+flags >= argc){
+						help();
+						return EXIT_FAILURE;
+					}
+					dump = argv[2+flags];
+					flags++;
+					break;
+			case 'r': rescan = 1; break;
+			case 'P': direct = 1; break;
+			case 'q':
+					if(4+flags >= argc){
+						help();
+						return EXIT_FAILURE;
+					}
+					query = &argv[2+flags];
+					flags += 3;
+					break;
+			case 'g':
+					if(2+flags >= argc || (group = atoi(argv[2+flags])) < 1){
+						help();
+						return EXIT_FAILURE;
+					}
+					flags++;
+					break;
+			case 'f':
+					if(2+flags >= argc || 
+								(fmt = render_format(argv[2+flags])) < 0){
+						help();
+						return EXIT_FAILURE;
+					}
+					flags++;
+					break;
+			case 'F':
+					if(2+flags >= argc || 
+						(fsync_policy = logwr_fsync_policy(argv[2+flags])) < 0){
+						help();
+						return EXIT_FAILURE;
+					}
+					flags++;
+					break;
+			case 'd':
+					if(2+flags >= argc){
+						help();
+						return EXIT_FAILURE;
+					}
+					daemon = 1;
+					period = atof(argv[2+flags]);
+					flags++;
+					break;
             case 'o':
                     if ( !strcasecmp(argv[1+flags], "-on") ){
 						hv_on = 1; break;
@@ -204,218 +1389,164 @@ int main(int argc, char *argv[]){
 		fprintf(stdout, "tool version 2.1\n");
 		return 0;
 	}
-	FILE *fp_conf;
-			
-	fp_conf = fopen("/home/hv/i2c-system/i2c-system.conf", "r");
+	conv_devices();
+	if(fmt < 0)
+		fmt = log || dump ? RENDER_LOG : RENDER_TEXT;
+	if(dump)
+		return dump_binlog(dump, fmt) < 0 ? EXIT_FAILURE : 0;
+	if(query){
+		return query_log(query[0], query[1], query[2], 
+						hv ? "hv" : sensors ? "sensors" : "") < 0 ? 
+														EXIT_FAILURE : 0;
+	}
+	if(daemon && (period <= 0 || dac || hv_on || hv_off)){
+		fprintf(stderr, "Error: -d needs a period > 0 s and can't be used "
+												"with -Vset, -Ilim, -on, -off\n");
+		return EXIT_FAILURE;
+	}
 
-	int c;
-	char line[CONFIG_FILE_LINE_MAX];
-	struct i2c_child_bus subsystem[SUBSYS_N_MAX];
-	int pos = 0; int subsys_n=0;
-	
-	while((c = getc(fp_conf)) != EOF){
-		if(c == '#'){
-			while((c = fgetc(fp_conf)) != '\n');
-		} else if(c == '\n' && pos == 0){
-			continue;
-		} else if(c==' ' || c=='\t'){
-			continue;
-		} else if(pos >= CONFIG_FILE_LINE_MAX){
-			line[CONFIG_FILE_LINE_MAX-1] = '\0';
-			pos = 0;
-			fprintf(stderr, "Error in network.conf file\n");
-			return EXIT_FAILURE;
-		} else if(c == '\n' && pos != 0){
-			line[pos] = '\0';
-			//printf("%s\n", line);
-
-			char *token_frst; char *token_scnd; char tmp_type[16];
-			token_frst = strtok(line, "=");
-			token_scnd = strtok(NULL, " ");
-			struct device *tmp_dev_list;
-			int tmp_bus_num = token_frst[3] - 0x30;
-			if(tmp_bus_num<0 || tmp_bus_num>8){
-				fprintf(stderr, "Error in network.conf: %s not an bus\n", 
-																	token_frst);
-				return EXIT_FAILURE;
-			}
-			if(!strcasecmp(token_scnd, "hv")){
-				tmp_dev_list = hv_dev_list;
-				strcpy(tmp_type, "hv");
-			}
-			else if(!strcasecmp(token_scnd, "sensors")){
-				tmp_dev_list = sensors_dev_list;
-				strcpy(tmp_type, "sensors");
-			}
-			else{
-				fprintf(stderr, "Error in network.conf: %s not a bus option\n", 
-																	token_scnd);
-				return EXIT_FAILURE;
-			}
-			if(subsys_n>=SUBSYS_N_MAX){
-				fprintf(stderr, "Error in network.conf: too much busses");
-				return EXIT_FAILURE;
-			}
-			strcpy(subsystem[subsys_n].type, tmp_type);
-			subsystem[subsys_n].bus_num = tmp_bus_num;
-			subsystem[subsys_n].device_list = tmp_dev_list;
-
-			pos = 0;
-			subsys_n++;
-			line[pos] = '\0';
-		} else{
-			line[pos] = c;
-  			pos++;
-		}
-	}
-
-	subsystem[subsys_n].bus_num = -1; 
-//	int sb; int sbb;
-//	for(sb=0; subsystem[sb].bus_num !=-1; sb++){
-//		printf("%d\n", subsystem[sb].bus_num);
-//		for(sbb=0; subsystem[sb].device_list[sbb].name[0] !='\0'; sbb++){
-//			printf("%s\n", subsystem[sb].device_list[sbb].name);
-//		}
-//	}	
-
-   	int fd_dev;
-	int res = -1;
-	char str[20];
-	int logfile;
-
-if(log){
-		time_t rawtime;
-	  	struct tm *info;
-		char date[20];
-		char hour[32];
-		char file_path [64] = "/home/hv/i2c-system/log/";
-	   	time( &rawtime );
-		info = localtime( &rawtime );
-
-	   	if(hv){
-			sprintf(date, "hv%04d-%02d-%02d.log", info->tm_year+1900,
-	   											  info->tm_mon+1,
-	   											  info->tm_mday);
-		}
-		else if(sensors){
-			sprintf(date, "sensors%04d-%02d-%02d.log", info->tm_year+1900,
-	   												   info->tm_mon+1,
-	   												   info->tm_mday);
-		}
-		else{
-			sprintf(date, "%04d-%02d-%02d.log", info->tm_year+1900,
-	   												   info->tm_mon+1,
-	   												   info->tm_mday);
-		}
-
-	   	strcat(file_path, date);								
-	   	logfile = open(file_path, O_WRONLY|O_APPEND|O_CREAT);
-	   	fchmod(logfile, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-	   		
-	   	sprintf(hour, "%04d-%02d-%02dT%02d:%02d:%02d; ", info->tm_year+1900, 
-	   													info->tm_mon+1,
-	   												   	info->tm_mday,
-	   												   	info->tm_hour, 
-	   									   				info->tm_min, 
-	   									   				info->tm_sec);
+	struct i2c_child_bus subsystem[SUBSYS_N_MAX+1];
 	
-		write(logfile, hour, 21);
+	if(read_config(CONFIG_FILE, subsystem) < 0)
+		return EXIT_FAILURE;
+
+	int res = 0;
+	static struct logwr logw;
+	int m; int k;
+	const char *only = NULL;
+	const char *type = hv ? "hv" : sensors ? "sensors" : NULL;
+	static struct i2c_cache cache;
+
+	i2c_cache_load(&cache, I2C_CACHE_FILE);
+	if(group == 0)			//the daemon commits LOGWR_GROUP lines at once
+		group = daemon ? LOGWR_GROUP : 1;
+	if(log)
+		open_log(&logw, hv, sensors, binary ? "bin" : render_ext(fmt), 
+													group, fsync_policy);
+	else
+		logwr_init_fd(&logw, STDOUT_FILENO, 1);	//a write() per cycle
+
+	if(dac)
+		only = "ad5694";
+	else if(hv_on || hv_off)
+		only = "mcp23009";
+
+	if(open_child_busses(subsystem, &cache, type, rescan, only, direct) < 0){
+		res = EXIT_FAILURE;
+		goto OUT;
 	}
 
-	int m; int n;
-	for(m=0; subsystem[m].bus_num != -1; m++){
-		if(hv){
-			if(strcmp(subsystem[m].type, "hv")) //increment m until reach hv
-					continue;
-			}
-		if(sensors){
-			if(strcmp(subsystem[m].type, "sensors"))
+	if(dac){
+		__u16 code[4] = {vset_ilim_to_ad5694(dac_val[0]), 
+								vset_ilim_to_ad5694(dac_val[1]), 0, 0};
+		if(dac_child_busses(subsystem, dac, code, direct) < 0)
+			res = EXIT_FAILURE;
+		goto OUT;
+	}
+
+	if(hv_on || hv_off){
+		for(m=0; subsystem[m].adapter != -1; m++){
+			for(k=0; k<subsystem[m].node_n; k++){
+				int fd_dev = subsystem[m].fd;
+				int addri = subsystem[m].node[k].addr;
+				struct mcp23009 *io;
+				if(subsystem[m].node[k].busy)
 					continue;
+				io = mcp23009_hv(fd_dev, addri);	//-on, -off: HVon only
+				if(io == NULL || (hv_on ? mcp23009_set(io, MCP23009_HV_ON) :
+								mcp23009_clear(io, MCP23009_HV_ON)) < 0)
+					fprintf(stderr, "Error: can't switch the HV %s on "
+							"i2c-%d; %s\n", hv_on ? "on" : "off", 
+							subsystem[m].adapter, strerror(errno));
 			}
-		fd_dev = setup_mux_child_bus(subsystem[m].bus_num);
-		for(n=0; subsystem[m].device_list[n].name[0]!='\0'; n++){
-			//printf("node min: %x max: %x \n", i2c_nodes_list[m].dev.addr_low,
-			//									i2c_nodes_list[m].dev.addr_high);
-			if(dac){
-				if(strcmp(subsystem[m].device_list[n].name,"ad5694"))
-					continue;
+		}
+		goto OUT;
+	}
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+
+	struct timespec next;
+	struct timespec ts;
+	struct timespec now;
+	static struct i2c_child_bus fresh[SUBSYS_N_MAX+1];
+	int ifd = daemon ? config_watch(CONFIG_FILE) : -1;
+	static struct binlog_rec rec[SUBSYS_N_MAX*NODE_N_MAX];
+	static struct render_item it[SUBSYS_N_MAX*NODE_N_MAX];
+	int rec_n;
+	struct bus_worker worker[SUBSYS_N_MAX];
+	int worker_n = group_workers(subsystem, worker);
+	if(daemon)
+		period_ns = llround(period * 1e9);
+	if(!log && fmt == RENDER_CSV)
+		write(STDOUT_FILENO, RENDER_CSV_HEADER, strlen(RENDER_CSV_HEADER));
+
+	do{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for(m=0; subsystem[m].adapter != -1; m++)
+			due_child_bus(&subsystem[m], &now, period_ns);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		if(worker_n > 0)
+			read_workers(worker, worker_n);
+		fflush(stdout);			//driver messages before the cycle
+
+		rec_n = 0;
+		for(m=0; subsystem[m].adapter != -1; m++){
+			if(subsystem[m].fd < 0)
+				continue;
+			if(binary){
+				rec_n += binlog_child_bus(&subsystem[m], &rec[rec_n], 
+						(__u64)ts.tv_sec*1000000000ULL + ts.tv_nsec);
 			}
-			else if(hv_on || hv_off){
-				if(strcmp(subsystem[m].device_list[n].name,"mcp23009"))
-					continue;
+			else{
+				conv_child_bus(&subsystem[m]);
+				rec_n += render_child_bus(&subsystem[m], &it[rec_n]);
 			}
+		}
+		if(logwr_line_start(&logw, ts.tv_sec) < 0){
+			res = EXIT_FAILURE;
+			goto OUT;
+		}
+		if(binary)			//one record per node, the cycle is one line
+			logwr_append(&logw, rec, rec_n*sizeof(rec[0]));
+		else
+			render_log(&logw, fmt, &ts, it, rec_n);
+		logwr_line_end(&logw);
 
-			//__u8 addr_list[8];
-			//res = scan_i2c_bus(fd_dev, MODE_AUTO, funcs, 
-			//										i2c_nodes_list[m].dev.addr_low,
-			//										i2c_nodes_list[m].dev.addr_high,
-			//										addr_list);
-
-			int addri; int i=0;
-			int low = subsystem[m].device_list[n].addr_low;
-			int high = subsystem[m].device_list[n].addr_high; 
-			for(addri=low; addri<=high; addri++){
-				if(ioctl(fd_dev, I2C_SLAVE, addri) < 0) {
-				    if (errno == EBUSY) {
-			        	if(log){
-							sprintf(str, "0 ");
-							write(logfile, str, strlen(str));
-						}
-						else{
-							printf("%s%d: 0\n", subsystem[m].device_list[n].data_type[0], i);
-							i++;
-							}
-						continue;
-			        } else {
-			            fprintf(stderr, "Error: Could not set "
-	 			                                 	"address to 0x%02x: %s\n", addri,
-			     				                               	strerror(errno));
-			            return -1;
-			        }
-				}
+		if(!daemon)
+			break;
 
-				if( i2c_smbus_write_quick(fd_dev, I2C_SMBUS_WRITE) < 0)
-					continue;
+		next = now;
+		timespec_add_ns(&next, period_ns);	//no node at all
+		for(m=0; subsystem[m].adapter != -1; m++)
+			deadline_child_bus(&subsystem[m], &next);
+		while(!stop && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, 
+														&next, NULL) == EINTR);
 
-				if(dac){
-					ad5694_write_ch(fd_dev, addri, dac_ch, 
-													  vset_ilim_to_ad5694(dac_val));
-				}
-				else if(hv_on){
-					mcp23009_write_val(fd_dev, addri, MCP23009_REG_GPPU, 0x08);
-					mcp23009_write_val(fd_dev, addri, MCP23009_REG_IODIR, 0x17);
-					mcp23009_write_val(fd_dev, addri, MCP23009_REG_GPIO, 0x08);
-				}
-				else if(hv_off){
-					mcp23009_write_val(fd_dev, addri, MCP23009_REG_GPPU, 0x08);
-					mcp23009_write_val(fd_dev, addri, MCP23009_REG_IODIR, 0x17);
-					mcp23009_write_val(fd_dev, addri, MCP23009_REG_GPIO, 0x00);
-				}
-				else{
-					subsystem[m].device_list[n].read_val(fd_dev, addri, 
-											   subsystem[m].device_list[n].val);
-					//printf("%s%d: %0.3f\n", i2c_nodes_list[m].dev.data_type, 
-					//													   i, data);
-		
-					subsystem[m].device_list[n].print_val(
-										 subsystem[m].device_list[n].val, 
-										 subsystem[m].device_list[n].lsb,
-										 subsystem[m].device_list[n].conv_param,
-										 subsystem[m].device_list[n].data_type,
-										 i, log, logfile);
-					i++;
-				}	
-			}
-		
+		if(ifd >= 0 && config_changed(ifd, CONFIG_FILE) && 
+								read_config(CONFIG_FILE, fresh) >= 0){
+			for(m=0; subsystem[m].adapter != -1; m++)
+				report_child_bus(&subsystem[m], period_ns);
+			report_workers(worker, worker_n);
+			close_child_busses(subsystem);
+			memcpy(subsystem, fresh, sizeof(fresh));
+			if(open_child_busses(subsystem, &cache, type, 0, NULL, direct) < 0)
+				fprintf(stderr, "Error: some busses of the new %s are not "
+											"read\n", CONFIG_FILE);
+			worker_n = group_workers(subsystem, worker);
+			fprintf(stderr, "%s reloaded\n", CONFIG_FILE);
 		}
-	}
-	
-	fclose(fp_conf);
-	close(fd_dev);
-	if(log){
-		write(logfile, "\n", 1);
-		close(logfile);
-	}
+	}while(!stop);
+	if(ifd >= 0)
+		close(ifd);
+	for(m=0; daemon && subsystem[m].adapter != -1; m++)
+		report_child_bus(&subsystem[m], period_ns);
+	if(daemon)
+		report_workers(worker, worker_n);
+
+OUT:
+	close_child_busses(subsystem);
+	logwr_close(&logw);
 	
 	return res;
 }
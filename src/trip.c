@@ -0,0 +1,199 @@
+/*
+*	trip.c -	HV overcurrent trip watcher, see trip.h.
+*
+*	hv -off looks the MCP23009 up and reads its registers before the
+*	write that clears HVon, and nothing watches the currents in between.
+*	Here everything that can be is done before the watch: the
+*	thresholds are ADC codes, the off write is a ready i2c_msg with the
+*	latched outputs less HVon. The poll is 2 conversions (~1 ms at
+*	100 kHz) and the loop never sleeps; a breach costs one more ioctl.
+*	The worst case from a breach to HVon cleared is one poll period plus
+*	the detection to off time, both reported as percentiles.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include "trip.h"
+#include "mcp23009.h"
+#include "func_reg.h"
+
+#define TRIP_MASK	0x03		//IHVp, IHVn
+
+static long long trip_now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static inline void trip_sample(long long *s, unsigned long *n, long long v){
+	s[(*n)++ & (TRIP_SAMPLES - 1)] = v;
+}
+
+static inline int trip_breach(struct trip *t){
+	return t->fb[0] > t->th[0] || t->fb[1] > t->th[1];
+}
+
+/*
+*	The prebuilt transfer (HVon off, or the GPIO read of a dry run), up to
+*	TRIP_OFF_TRIES times. If it keeps failing HVon is cleared once more
+*	with a plain SMBus write through I2C_SLAVE.
+*/
+static int trip_off(struct trip *t){
+	struct i2c_rdwr_ioctl_data rdwr = {.msgs = t->off_msg,
+												.nmsgs = t->dry ? 2 : 1};
+	int k;
+
+	for(k=0; k<TRIP_OFF_TRIES; k++){
+		if(ioctl(t->fd, I2C_RDWR, &rdwr) >= 0)
+			return 0;
+		t->off_errors++;
+	}
+	fprintf(stderr, "trip: off transfer failed %d times; %s\n", k, 
+															strerror(errno));
+	if(t->dry)
+		return -1;
+	if(mcp23009_clear(t->io, MCP23009_HV_ON) < 0)
+		return -1;
+	fprintf(stderr, "trip: HVon cleared through I2C_SLAVE\n");
+	return 0;
+}
+
+/*Reads the MCP23009 once and builds the off write, thresholds in codes*/
+int trip_init(struct trip *t, int fd, int adc_addr, int gpio_addr,
+											__u16 th_p, __u16 th_n, int dry){
+	struct mcp23009 *m;
+	__u8 iodir; __u8 olat;
+
+	memset(t, 0, sizeof(*t));
+	t->fd = fd;
+	t->adc_addr = adc_addr;
+	t->gpio_addr = gpio_addr;
+	t->th[0] = th_p;
+	t->th[1] = th_n;
+	t->dry = dry;
+	if(i2c_batch_init(&t->batch, fd) < 0)
+		return -1;
+	if(!(t->batch.funcs & I2C_FUNC_I2C)){
+		fprintf(stderr, "Error: the trip watcher needs I2C_RDWR\n");
+		return -1;
+	}
+	if((m = mcp23009_session(fd, gpio_addr)) == NULL){
+		fprintf(stderr, "Error: can't read the MCP23009; %s\n",
+															strerror(errno));
+		return -1;
+	}
+	t->io = m;
+	iodir = m->reg[MCP23009_REG_IODIR];
+	olat = m->reg[MCP23009_REG_OLAT];
+	if(iodir & MCP23009_HV_ON){
+		fprintf(stderr, "Error: HVon is an input (IODIR 0x%02x)\n", iodir);
+		return -1;
+	}
+	if(!(olat & MCP23009_HV_ON))
+		fprintf(stderr, "Warning: HVon is already off\n");
+
+	t->off_buf[0] = MCP23009_REG_GPIO;
+	t->off_buf[1] = olat & ~MCP23009_HV_ON;
+	t->off_msg[0].addr = gpio_addr;
+	t->off_msg[0].flags = 0;
+	t->off_msg[0].len = dry ? 1 : 2;
+	t->off_msg[0].buf = t->off_buf;
+	t->off_msg[1].addr = gpio_addr;
+	t->off_msg[1].flags = I2C_M_RD;
+	t->off_msg[1].len = 1;
+	t->off_msg[1].buf = &t->rd_buf;
+	return 0;
+}
+
+/*
+*	Watches until a trip (1), sec seconds or cancel (0), or a failed off
+*	write (-1). A dry run only returns 0.
+*/
+int trip_run(struct trip *t, double sec){
+	long long t0; long long last; long long now;
+	long long end = sec > 0 ? sec * 1e9 : 0;
+	int armed = 1; int fail = 0;
+
+	t0 = last = trip_now();
+	while(!(t->cancel && *t->cancel) && !(end && last - t0 >= end)){
+		if(ads7828_queue_ch(&t->batch, t->adc_addr, TRIP_MASK, t->fb) < 0)
+			return -1;
+		if(i2c_batch_flush(&t->batch) < 0){
+			t->errors++;
+			if(++fail < TRIP_FAIL_MAX)
+				continue;
+			fprintf(stderr, "trip: %d failed polls; %s\n", fail,
+															strerror(errno));
+		}
+		else
+			fail = 0;
+		now = trip_now();
+		t->polls++;
+		trip_sample(t->period_ns, &t->period_n, now - last);
+		last = now;
+
+		if(!fail && !trip_breach(t)){
+			armed = 1;
+			continue;
+		}
+		if(!armed)
+			continue;
+		if(trip_off(t) < 0){
+			fprintf(stderr, "Error: %s; %s\n", t->dry ? "dry run transfer "
+						"failed" : "can't clear HVon", strerror(errno));
+			return -1;
+		}
+		last = trip_now();
+		trip_sample(t->lat_ns, &t->lat_n, last - now);
+		t->trips++;
+		if(fail)
+			fail = 0;
+		else
+			fprintf(stderr, "trip: IHVp %u IHVn %u over %u %u\n", t->fb[0],
+										t->fb[1], t->th[0], t->th[1]);
+		if(!t->dry)
+			return 1;
+		armed = 0;
+	}
+	return 0;
+}
+
+static int trip_cmp(const void *a, const void *b){
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+/*p50, p90, p99, p99.9 and max of the n last samples, ms*/
+static void trip_pct(const char *name, long long *s, unsigned long n){
+	static long long sorted[TRIP_SAMPLES];
+	static const double pct[4] = {0.5, 0.9, 0.99, 0.999};
+	int k;
+
+	if(n > TRIP_SAMPLES)
+		n = TRIP_SAMPLES;
+	if(n == 0){
+		fprintf(stderr, "trip: %s: no sample\n", name);
+		return;
+	}
+	memcpy(sorted, s, n * sizeof(sorted[0]));
+	qsort(sorted, n, sizeof(sorted[0]), trip_cmp);
+	fprintf(stderr, "trip: %s (%lu):", name, n);
+	for(k=0; k<4; k++)
+		fprintf(stderr, " p%g %0.3f", pct[k]*100,
+						sorted[(unsigned long)(pct[k] * (n - 1))]/1e6);
+	fprintf(stderr, " max %0.3f ms\n", sorted[n-1]/1e6);
+}
+
+/*Poll period and detection to off percentiles, to stderr*/
+void trip_report(struct trip *t){
+	fprintf(stderr, "trip: %lu polls, %lu trips%s, %lu failed polls, "
+			"%lu failed off transfers\n", t->polls, t->trips, 
+			t->dry ? " (dry run)" : "", t->errors, t->off_errors);
+	trip_pct("poll period", t->period_ns, t->period_n);
+	trip_pct("detection to off", t->lat_ns, t->lat_n);
+}
@@ -0,0 +1,51 @@
+#ifndef __TRIP_H__
+#define __TRIP_H__
+/*
+*	trip.h -	HV overcurrent trip watcher.
+*/
+#include <signal.h>
+#include <linux/types.h>
+#include "i2c_bus.h"
+#include "mcp23009.h"
+
+#define TRIP_FAIL_MAX		3			//failed polls in a row trip too
+#define TRIP_OFF_TRIES		3			//off transfers before I2C_SLAVE
+#define TRIP_SAMPLES		(1<<16)		//power of 2, samples kept for the
+										//percentiles
+
+/* IHVp and IHVn are converted back to back, one I2C_RDWR per poll, and
+   compared as raw codes against th[]. On a breach the GPIO write that
+   clears HVon, built at trip_init(), goes out as it is: no probe, no
+   I2C_SLAVE, no read-modify-write. dry does a GPIO read of the same
+   length instead, the watcher then re-arms once both currents are back
+   under th[] and keeps on. An off transfer that keeps failing falls back
+   to mcp23009_clear() on the session io. Times are ns. */
+struct trip{
+	int fd;
+	int adc_addr;
+	int gpio_addr;
+	__u16 th[2];				//IHVp, IHVn codes
+	int dry;
+	struct mcp23009 *io;		//session opened by trip_init()
+	const volatile sig_atomic_t *cancel;
+	struct i2c_batch batch;
+	__u8 off_buf[2];
+	__u8 rd_buf;
+	struct i2c_msg off_msg[2];
+	__u16 fb[8];
+	unsigned long polls;
+	unsigned long trips;
+	unsigned long errors;		//failed polls
+	unsigned long off_errors;	//failed off transfers
+	unsigned long period_n;
+	unsigned long lat_n;
+	long long period_ns[TRIP_SAMPLES];	//between two polls
+	long long lat_ns[TRIP_SAMPLES];		//end of the poll to HVon cleared
+};
+
+int trip_init(struct trip *t, int fd, int adc_addr, int gpio_addr,
+											__u16 th_p, __u16 th_n, int dry);
+int trip_run(struct trip *t, double sec);
+void trip_report(struct trip *t);
+
+#endif